@@ -42,8 +42,7 @@ class IfStmt
     bkcontinue = ctx.current_method.function.basic_blocks.append("ifcontinue")
     ctx.with_builder_at_end(bkcond) do |b|
       val = cond.codegen(ctx)
-      cmp = b.icmp(:eq, val, ctx.build_call.pup_env_get_falseinstance(ctx.current_method.env), "is_false")
-      b.cond(cmp, bkelse, bkthen)
+      b.cond(ctx.build_is_falsy(val), bkelse, bkthen)
     end
     ctx.with_builder_at_end(bkthen) do |b|
       v = ifbk.codegen(ctx)
@@ -57,7 +56,10 @@ class IfStmt
 	b.br(bkcontinue)
       end
     else
-      raise "write code to make the 'result' of the if-stmt be nil"
+      ctx.with_builder_at_end(bkelse) do |b|
+	b.store(ctx.immediate(nil), result)
+	b.br(bkcontinue)
+      end
     end
     ctx.build.position_at_end(bkcontinue)
     ctx.build.load(result, "if_result")
@@ -68,7 +70,7 @@ class WhileStmt
   def codegen(ctx)
     # alloacte a place to store the 'value' of the if-stmt,
     result = ctx.current_method.entry_block_builder.alloca(::Pup::Core::Types::ObjectPtrType, "while_tmp_value")
-    # TODO: write nil to while_tmp_value
+    ctx.build.store(ctx.immediate(nil), result)
 
     bkcond = ctx.current_method.function.basic_blocks.append("while_cond")
     ctx.build.br(bkcond)
@@ -77,8 +79,7 @@ class WhileStmt
 
     ctx.with_builder_at_end(bkcond) do |b|
       val = cond.codegen(ctx)
-      cmp = b.icmp(:eq, val, ctx.build_call.pup_env_get_falseinstance(ctx.current_method.env), "is_false")
-      b.cond(cmp, bkcontinue, bkbody)
+      b.cond(ctx.build_is_falsy(val), bkcontinue, bkbody)
     end
     ctx.with_builder_at_end(bkbody) do |b|
       v = statements.codegen(ctx)
@@ -146,12 +147,35 @@ class VarOrInvokeExpr
   end
 
   def codegen_invoke(ctx)
+    return codegen_local_raise(ctx) if local_raise?(ctx)
     # TODO: varargs
     r = @receiver ? @receiver.codegen(ctx) : ctx.self_ref
 
     arg_list = @args ? @args.map {|a| a.codegen(ctx) } : []
     ctx.build_method_invocation(r, name.name, *arg_list)
   end
+
+  def local_raise?(ctx)
+    @receiver.nil? && @name.name == "raise" && @args && @args.size == 1 &&
+      ctx.local_rescue?
+  end
+
+  # a raise within a begin-block whose rescue-blocks are in this same
+  # function branches straight to them, unless 'self' has a raise method
+  # of its own, which is invoked as normal
+  def codegen_local_raise(ctx)
+    arg = @args.first.codegen(ctx)
+    excep = ctx.build_call.pup_exception_for_local_raise(ctx.current_method.env, ctx.self_ref, arg, "local_excep")
+    is_local = ctx.build.icmp(:ne, excep, ::Pup::Core::Types::ObjectPtrType.null, "is_local_raise")
+    bklocal = ctx.current_method.function.basic_blocks.append("local_raise")
+    bkinvoke = ctx.current_method.function.basic_blocks.append("invoke_raise")
+    ctx.build.cond(is_local, bklocal, bkinvoke)
+    ctx.with_builder_at_end(bklocal) do
+      ctx.build_local_rescue_branch(excep)
+    end
+    ctx.build.position_at_end(bkinvoke)
+    ctx.build_method_invocation(ctx.self_ref, @name.name, arg)
+  end
 end
 
 class InstVarExpr
@@ -185,6 +209,12 @@ class RelationalExpr
   end
 end
 
+class ShiftExpr
+  def codegen_binary(ctx, lhs, rhs)
+    ctx.build_method_invocation(lhs, "<<", rhs)
+  end
+end
+
 class AddExpr
   def codegen_binary(ctx, lhs, rhs)
     ctx.build_method_invocation(lhs, "+", rhs)
@@ -192,15 +222,10 @@ class AddExpr
 end
 
 class StringLiteral
+  # the String object is created once, at startup (see
+  # CodegenContext#build_literals_init_fn), and shared by every evaluation
   def codegen(ctx)
-    str = value
-    me = self
-    ctx.eval_build do
-      data = global_string(str)
-      src_ptr = gep(data, [LLVM.Int(0),LLVM.Int(0)], "src_ptr")
-      ctx.build_call.pup_string_new_cstr(ctx.current_method.env,
-                                         src_ptr, "str_#{me.sanitise(str)}")
-    end
+    ctx.build.load(ctx.string_literal(value), "str_#{sanitise(value)}")
   end
 
   # derive a (shortened) string safe for use as an LLVM variable name
@@ -217,11 +242,13 @@ end
 
 class BoolLiteral
   def codegen(ctx)
-    if true?
-      ctx.build_call.pup_env_get_trueinstance(ctx.current_method.env)
-    else
-      ctx.build_call.pup_env_get_falseinstance(ctx.current_method.env)
-    end
+    ctx.immediate(true?)
+  end
+end
+
+class NilLiteral
+  def codegen(ctx)
+    ctx.immediate(nil)
   end
 end
 
@@ -274,8 +301,7 @@ class MethodDef
 	    ret = body.codegen(ctx)
 	    ctx.build.ret(ret)
 	  else
-            # TODO: return nil
-	    ctx.build.ret(ObjectPtrType.null)
+	    ctx.build.ret(ctx.immediate(nil))
 	  end
 	end
       end
@@ -320,19 +346,24 @@ class BeginStmt
   def codegen(ctx)
     # alloacte a place to store the 'value' of the begin-stmt,
     result = ctx.current_method.entry_block_builder.alloca(::Pup::Core::Types::ObjectPtrType, "begin_tmp_value")
-    landing_pad = nil
+    landingpad = nil
+    local_rescue = nil
     if !rescuebks.empty?
       landingpad = ctx.current_method.function.basic_blocks.append("landingpad")
+      # both the landingpad and any raise within the begin-block itself
+      # pass the exception on to the rescue-blocks via excep_slot
+      excep_slot = ctx.current_method.entry_block_builder.alloca(::Pup::Core::Types::ObjectPtrType, "excep_slot")
+      dispatch = ctx.current_method.function.basic_blocks.append("rescue_dispatch")
+      local_rescue = CodegenContext::LocalRescue.new(dispatch, excep_slot)
     end
 
     begin_block = nil
-    ctx.eh_begin(landingpad) do
+    ctx.eh_begin(landingpad, local_rescue) do
       v = beginbk.codegen(ctx)
       ctx.build.store(v, result)
       begin_block = ctx.build.insert_block
       # will add a br to after_beginblock later, once that block has been appended
     end
-    dwarf_ex = nil
     rescue_impls = []
     ctx.with_builder_at_end(landingpad) do |b|
       dwarf_ex = b.call(ctx.module.functions["llvm.eh.exception"], "dwarf_ex")
@@ -340,7 +371,14 @@ class BeginStmt
 		   dwarf_ex,
 		   ctx.module.functions["pup_eh_personality"].bit_cast(LLVM::Int8.type.pointer),
                    ctx.eh_catchall, "sel")
-      excep = ctx.build_call.extract_exception_obj(dwarf_ex, "excep")
+      # the unwind header goes back to the pool here; the object is all
+      # the rescue-blocks need
+      excep = ctx.build_call.pup_catch_exception(dwarf_ex, "excep")
+      b.store(excep, excep_slot)
+      b.br(dispatch)
+    end
+    ctx.with_builder_at_end(dispatch) do |b|
+      excep = b.load(excep_slot, "excep")
       excep_type = ctx.build.load(ctx.build.struct_gep(excep, 0), "excep_type")
       excep_type_asobj = ctx.build.bit_cast(excep_type, ::Pup::Core::Types::ObjectPtrType, "excep_type_asobj")
       ctx.eh_handle(excep) do
@@ -348,8 +386,13 @@ class BeginStmt
 	  rescuebk.codegen(ctx, result, excep, excep_type_asobj, rescue_impls)
 	end
       end
-      ctx.build_call.pup_rethrow_uncaught_exception(dwarf_ex)
-      ctx.build.ret(::Pup::Core::Types::ObjectPtrType.null)
+      # no rescue-block matched, so on to any enclosing handler,
+      if ctx.local_rescue?
+	ctx.build_local_rescue_branch(excep)
+      else
+	ctx.build_call.pup_raise(excep)
+	ctx.build.ret(::Pup::Core::Types::ObjectPtrType.null)
+      end
     end
 
     bkout = ctx.current_method.function.basic_blocks.append("after_beginblock")
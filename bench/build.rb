@@ -0,0 +1,38 @@
+# Builds a pup program in the same way as tests/framework.rb builds the
+# tests; shared by the scripts in bench/, which run from this directory.
+require 'fileutils'
+
+LLVM_BIN = "/home/dave/opt/llvm-3.0/bin"
+
+RUNTIME_OBJS = %w{runtime exception raise string class object symtable image
+                  env heap fixnum gcstat io gc gc/refqueue gc/eventlog}
+
+def run(cmd)
+  raise "#{cmd.inspect} failed" unless system(cmd)
+end
+
+# 'runtime_image' may be false to leave out the runtime image, so that the
+# program bootstraps the runtime as it starts.  With 'lto', the program is
+# linked with the runtime's bitcode (see libpup.bc in the Makefile) and the
+# two optimised together, rather than linked with the runtime's objects.
+def build(name, output = name, runtime_image = true, lto = false)
+  raise "pup failed" unless system("../pup #{name}.pup")
+  bc = "#{name}.bc"
+  objs = []
+  if lto
+    bc = "#{name}.lto.bc"
+    run("#{LLVM_BIN}/llvm-link #{name}.bc ../libpup.bc -o #{bc}")
+    run("#{LLVM_BIN}/opt -O2 #{bc} -o #{bc}")
+  else
+    objs += RUNTIME_OBJS
+  end
+  objs << "runtime_image" if runtime_image
+  # frame pointers are required by the GC's stack walker
+  llc_opt = lto ? "-O2" : ""
+  raise "llc failed" unless system("#{LLVM_BIN}/llc #{llc_opt} -load ../gclib/Release+Asserts/lib/pupgcplugin.so -disable-fp-elim #{bc} -o #{name}.S")
+  raise "as failed" unless system("as #{name}.S -o #{name}.o")
+  objs = objs.map {|o| "../#{o}.o" }.join(" ")
+  run("gcc -rdynamic -pthread #{name}.o #{objs} -lrt -lunwind -lunwind-x86_64 -ldl -o #{output}")
+ensure
+  FileUtils.rm_f ["#{name}.bc", "#{name}.lto.bc", "#{name}.S", "#{name}.o"]
+end
@@ -0,0 +1,35 @@
+# Times each tests/*.pup program (or just those named on the command line)
+# built against the runtime's objects, as the tests are, and then built by
+# LTO against libpup.bc, as a table of the best of a few runs of each.
+# Output goes to /dev/null; the programs' exit statuses are ignored, as some
+# tests end in an uncaught exception.
+#
+#   make libpup.bc && ruby bench/lto.rb [name...]
+require 'benchmark'
+require 'fileutils'
+require File.join(File.dirname(__FILE__), 'build')
+
+RUNS = 5
+
+def best_time(prog)
+  (1..RUNS).map do
+    Benchmark.realtime { system("./#{prog} > /dev/null 2>&1") }
+  end.min
+end
+
+Dir.chdir(File.join(File.dirname(__FILE__), "..", "tests")) do
+  names = ARGV.empty? ? Dir["*.pup"].map {|f| File.basename(f, ".pup") }.sort : ARGV
+  printf("%-24s %10s %10s %8s\n", "program", "objects", "lto", "speedup")
+  names.each do |name|
+    outputs = ["#{name}.objs", "#{name}.lto"]
+    begin
+      build(name, outputs[0])
+      build(name, outputs[1], true, true)
+      before, after = outputs.map {|o| best_time(o) }
+      printf("%-24s %9.2fms %9.2fms %7.2fx\n",
+             name, before * 1e3, after * 1e3, before / after)
+    ensure
+      FileUtils.rm_f outputs
+    end
+  end
+end
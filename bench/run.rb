@@ -0,0 +1,21 @@
+# Builds and times each bench/*.pup program (or just those named on the
+# command line), in the same way as tests/framework.rb builds the tests.
+# Output goes to /dev/null, so that it's not the terminal being measured.
+require 'benchmark'
+require 'fileutils'
+require File.join(File.dirname(__FILE__), 'build')
+
+Dir.chdir(File.dirname(__FILE__)) do
+  names = ARGV.empty? ? Dir["*.pup"].map {|f| File.basename(f, ".pup") }.sort : ARGV
+  names.each do |name|
+    build(name)
+    begin
+      time = Benchmark.realtime do
+        raise "#{name} failed" unless system("./#{name} > /dev/null")
+      end
+      printf("%-20s %8.2fs\n", name, time)
+    ensure
+      FileUtils.rm_f name
+    end
+  end
+end
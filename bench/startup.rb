@@ -0,0 +1,31 @@
+# Times starting bench/hello.pup many times, built with and without the
+# runtime image (see image.h), to measure what bootstrapping the runtime
+# costs each process.  Output goes to /dev/null.
+#
+#   ruby bench/startup.rb [runs]
+require 'benchmark'
+require 'fileutils'
+require File.join(File.dirname(__FILE__), 'build')
+
+runs = (ARGV[0] || 1000).to_i
+
+Dir.chdir(File.dirname(__FILE__)) do
+  variants = [["bootstrap", "hello_bootstrap", false],
+              ["image", "hello_image", true]]
+  begin
+    variants.each do |label, output, runtime_image|
+      build("hello", output, runtime_image)
+    end
+    printf("%-12s %12s\n", "runtime", "ms/start")
+    variants.each do |label, output, runtime_image|
+      time = Benchmark.realtime do
+        runs.times do
+          raise "#{output} failed" unless system("./#{output} > /dev/null")
+        end
+      end
+      printf("%-12s %12.3f\n", label, time * 1e3 / runs)
+    end
+  ensure
+    FileUtils.rm_f variants.map {|v| v[1] }
+  end
+end
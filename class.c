@@ -7,6 +7,8 @@
 #include "raise.h"
 #include "exception.h"
 #include "object.h"
+#include "class.h"
+#include "core_syms.h"
 #include "abortf.h"
 
 struct MethodListEntry {
@@ -20,10 +22,19 @@ struct PupClass {
 	struct PupClass *superclass;
 	char *name;
 	struct MethodListEntry *method_list_head;
+	// the runtime's own methods for the class, a static table searched
+	// before method_list_head, see pup_class_set_builtin_methods()
+	const struct PupBuiltinMethod *builtin_methods;
+	int builtin_method_count;
 	struct PupClass *scope;  /* for Constant lookup */
 	struct PupObject *(*allocate_instance)(ENV, struct PupClass *);  /* hax: until we have instance methods */
 	void (*destroy_instance)(struct PupObject *);
 	struct PupObject *(*gc_copy_instance)(ENV, const struct PupObject *);
+	// visits references held in instances' own fields, see
+	// pup_class_set_each_ref()
+	void (*each_ref)(struct PupObject *,
+	                 void (*)(struct PupObject **, void *),
+	                 void *);
 };
 
 void pup_internal_class_init(ENV,
@@ -40,10 +51,13 @@ void pup_internal_class_init(ENV,
 	class->name = strdup(name);
 	class->superclass = superclass;
 	class->method_list_head = NULL;
+	class->builtin_methods = NULL;
+	class->builtin_method_count = 0;
 	class->scope = scope;
 	class->allocate_instance = allocate_instance;
 	class->destroy_instance = destroy_instance;
 	class->gc_copy_instance = gc_copy_instance;
+	class->each_ref = NULL;
 }
 
 struct PupClass *pup_internal_create_class(ENV,
@@ -58,7 +72,7 @@ struct PupClass *pup_internal_create_class(ENV,
 	ABORTF_ON(!allocate_instance, "'allocate_instance' must not be NULL when creating class %s", name);
 	struct PupClass *class_class = pup_env_get_classclass(env);
 	struct PupObject *o = pup_invoke(env, (struct PupObject *)class_class,
-	                                 pup_env_str_to_sym(env, "new"),
+	                                 PUP_SYM_NEW,
 	                                 0, NULL);
 	struct PupClass *class = (struct PupClass *)o;
 	pup_internal_class_init(env, class, superclass, scope, name, allocate_instance, destroy_instance, gc_copy_instance);
@@ -70,13 +84,16 @@ struct PupClass *pup_create_class(ENV,
                                   struct PupClass *scope,
                                   const char *name)
 {
+	ABORTF_ON(!superclass, "'superclass' must not be NULL when creating class %s", name);
+	// instances of a subclass have the same layout as those of its
+	// superclass (e.g. a subclass of Exception has room for a backtrace)
 	return pup_internal_create_class(env,
 	                                 superclass,
 	                                 scope,
 	                                 name,
-	                                 &pup_object_allocate_instance,
-	                                 &pup_object_destroy_instance,
-	                                 &pup_object_gc_copy_instance);
+	                                 superclass->allocate_instance,
+	                                 superclass->destroy_instance,
+	                                 superclass->gc_copy_instance);
 }
 
 // TODO: a name better differentiated from pup_class_allocate_instance()
@@ -150,6 +167,14 @@ void pup_define_method(struct PupClass *class, const long name_sym, PupMethod *m
 	*pos = new;
 }
 
+void pup_class_set_builtin_methods(struct PupClass *class,
+                                   const struct PupBuiltinMethod *methods,
+                                   int count)
+{
+	class->builtin_methods = methods;
+	class->builtin_method_count = count;
+}
+
 const char *pup_type_name(const struct PupClass *type)
 {
 	if (!type) {
@@ -173,12 +198,28 @@ static PupMethod *find_method_in_list(struct MethodListEntry *meth_list,
 	return NULL;
 }
 
+static PupMethod *find_builtin_method(const struct PupClass *class,
+                                      const long name_sym)
+{
+	for (int i=0; i<class->builtin_method_count; i++) {
+		if (class->builtin_methods[i].name_sym == name_sym) {
+			return class->builtin_methods[i].method;
+		}
+	}
+	return NULL;
+}
+
 PupMethod *find_method_in_classes(struct PupClass *class,
                                          const long name_sym)
 {
 	while (class) {
-		PupMethod *method = find_method_in_list(class->method_list_head,
-		                                     name_sym);
+		// builtins were defined first, and so take precedence
+		PupMethod *method = find_builtin_method(class, name_sym);
+		if (method) {
+			return method;
+		}
+		method = find_method_in_list(class->method_list_head,
+		                             name_sym);
 		if (method) {
 			return method;
 		}
@@ -211,8 +252,7 @@ struct PupObject *pup_const_get(struct PupClass *clazz, const int sym)
 {
 	struct PupObject *result;
 	struct PupClass *lookup = clazz;
-	/* TODO: while nil, rather than while NULL */
-	while ((result = pup_iv_get(&lookup->obj_header, sym)) == NULL) {
+	while ((result = pup_iv_get(&lookup->obj_header, sym)) == PUP_NIL) {
 		lookup = lookup->scope;
 		if (!lookup) break;
 	}
@@ -222,7 +262,7 @@ struct PupObject *pup_const_get(struct PupClass *clazz, const int sym)
 struct PupObject *pup_const_get_required(ENV, struct PupClass *clazz, const int sym)
 {
 	struct PupObject *res = pup_const_get(clazz, sym);
-	if (!res) {
+	if (res == PUP_NIL) {
 		// TODO: NameError
 		pup_raise(pup_new_runtimeerrorf(env, "uninitialized constant %s",
 		                                pup_env_sym_to_str(env, sym)));
@@ -232,7 +272,8 @@ struct PupObject *pup_const_get_required(ENV, struct PupClass *clazz, const int
 
 bool pup_is_class_instance(ENV, const struct PupObject *obj)
 {
-	return obj->type == pup_env_get_classclass(env);
+	return !PUP_IS_IMMEDIATE(obj)
+	       && obj->type == pup_env_get_classclass(env);
 }
 
 struct PupObject *pup_class_allocate_instance(ENV, struct PupClass *clazz)
@@ -273,26 +314,58 @@ void pup_class_gc_copy_instance(struct PupClass *class,
 	class->gc_copy_instance(env, obj);
 }
 
+void pup_class_set_each_ref(struct PupClass *class,
+                            void (*each_ref)(struct PupObject *,
+                                             void (*)(struct PupObject **, void *),
+                                             void *))
+{
+	class->each_ref = each_ref;
+}
+
+void pup_class_each_malloced(struct PupClass *class,
+                             void (*visitor)(void *, size_t, bool, void *),
+                             void *data)
+{
+	visitor(class->name, strlen(class->name) + 1, false, data);
+	for (struct MethodListEntry *pos = class->method_list_head;
+	     pos;
+	     pos = pos->next)
+	{
+		visitor(pos, sizeof(struct MethodListEntry), true, data);
+	}
+}
+
+void pup_class_each_ref(struct PupClass *class,
+                        struct PupObject *obj,
+                        void (*visitor)(struct PupObject **, void *),
+                        void *data)
+{
+	// instances of subclasses have their superclass's fields too,
+	for (; class; class=class->superclass) {
+		if (class->each_ref) {
+			class->each_ref(obj, visitor, data);
+			return;
+		}
+	}
+}
+
 METH_IMPL(pup_class_new)
 {
 	struct PupObject *res =
-		pup_invoke(env, target, pup_env_str_to_sym(env, "allocate"),
-		           0 , NULL);
+		pup_invoke(env, target, PUP_SYM_ALLOCATE, 0 , NULL);
 	// return value ignored,
-	pup_invoke(env, res, pup_env_str_to_sym(env, "initialize"),
-	           argc , argv);
+	pup_invoke(env, res, PUP_SYM_INITIALIZE, argc , argv);
 	return res;
 }
 
+const struct PupBuiltinMethod pup_class_methods[] = {
+	{ PUP_SYM_NEW, pup_class_new },
+	{ PUP_SYM_ALLOCATE, pup_object_allocate },
+	{ PUP_SYM_TO_S, pup_class_to_s }
+};
+
 void pup_class_class_init(ENV, struct PupClass *class_class)
 {
-	pup_define_method(class_class,
-	                  pup_env_str_to_sym(env, "new"),
-	                  pup_class_new);
-	pup_define_method(class_class,
-	                  pup_env_str_to_sym(env, "allocate"),
-	                  pup_object_allocate);
-	pup_define_method(class_class,
-	                  pup_env_str_to_sym(env, "to_s"),
-	                  pup_class_to_s);
+	pup_class_set_builtin_methods(class_class, pup_class_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_class_methods));
 }
@@ -1,4 +1,5 @@
 
+#include <stddef.h>
 #include <stdbool.h>
 
 const char *pup_type_name(const struct PupClass *type);
@@ -29,7 +30,8 @@ struct PupClass *pup_internal_create_class(ENV,
                                   struct PupClass *scope,
                                   const char *name,
                                   struct PupObject *(*allocate_instance)(ENV, struct PupClass *),
-                                  void (*destroy_instance)(struct PupObject *));
+                                  void (*destroy_instance)(struct PupObject *),
+                                  struct PupObject *(*gc_copy_instance)(ENV, const struct PupObject *));
 
 struct PupClass *pup_create_class(ENV,
                                   struct PupClass *superclass,
@@ -40,9 +42,51 @@ struct PupClass *pup_bootstrap_create_classclass(ENV, struct PupClass *class_obj
 
 void pup_define_method(struct PupClass *class, const long name_sym, PupMethod *method);
 
+struct PupBuiltinMethod {
+	long name_sym;
+	PupMethod *method;
+};
+
+#define PUP_BUILTIN_METHOD_COUNT(methods) \
+	((int)(sizeof(methods) / sizeof(struct PupBuiltinMethod)))
+
+/**
+ * Gives the class the runtime's own methods, from a table of static data
+ * (with names from core_syms.h) rather than one pup_define_method() call
+ * each.  The table is searched before any methods defined later.  Tables
+ * must not be static, so that pup_image_write() can name them.
+ */
+void pup_class_set_builtin_methods(struct PupClass *class,
+                                   const struct PupBuiltinMethod *methods,
+                                   int count);
+
 //void pup_class_free(struct PupClass *clazz);
 void pup_class_destroy_instance(struct PupClass *class, struct PupObject *obj);
 
+/**
+ * Sets the function the collector uses to find references held in the
+ * fields of this class's instances (beyond those every object has).
+ */
+void pup_class_set_each_ref(struct PupClass *class,
+                            void (*each_ref)(struct PupObject *,
+                                             void (*)(struct PupObject **, void *),
+                                             void *));
+
+/**
+ * Visits each block of malloc()ed memory the given class holds (its name
+ * and its method table entries) with the block's address and size, and
+ * whether it holds pointers; for pup_image_write(), which must copy these
+ * into the image along with the class itself.
+ */
+void pup_class_each_malloced(struct PupClass *class,
+                             void (*visitor)(void *, size_t, bool, void *),
+                             void *data);
+
+void pup_class_each_ref(struct PupClass *class,
+                        struct PupObject *obj,
+                        void (*visitor)(struct PupObject **, void *),
+                        void *data);
+
 void pup_const_set(ENV, struct PupClass* clazz, const int sym, struct PupObject *val);
 
 /*
@@ -1,3 +1,6 @@
+require 'llvm/execution_engine'
+require 'llvm/transforms/scalar'
+require 'llvm/transforms/ipo'
 
 module Pup
 module Parse
@@ -27,7 +30,10 @@ class CodegenContext
     @block = nil
     @serial = 0
     @landingpad = nil
+    @local_rescue = nil
     @excep = nil
+    # String value => global holding the String object for that literal
+    @string_literals = {}
 
     @call_sugar = CallSugar.new(self)
     @global_sugar = GlobalSugar.new(self)
@@ -50,6 +56,14 @@ class CodegenContext
     global_constant(str, str, name).bit_cast(CStrType)
   end
 
+  # the global which will refer to the shared String object for the given
+  # literal value
+  def string_literal(value)
+    @string_literals[value] ||= global_constant(ObjectPtrType,
+                                                ObjectPtrType.null,
+                                                "lit_#{@string_literals.size}")
+  end
+
   def append_block(name = "")
     last_block = @block
     result = @block = current_method.function.basic_blocks.append(name)
@@ -83,6 +97,19 @@ class CodegenContext
     @build
   end
 
+  # the ObjectPtrType value of nil, true or false
+  def immediate(value)
+    word = { nil => NilValue, false => FalseValue, true => TrueValue }[value]
+    build.int2ptr(LLVM::Int64.from_i(word), ObjectPtrType)
+  end
+
+  # whether the given value is nil or false, tested inline (see PUP_IS_FALSY)
+  def build_is_falsy(val)
+    bits = build.ptr2int(val, LLVM::Int64)
+    bits = build.or(bits, LLVM::Int64.from_i(FalseValue ^ NilValue))
+    build.icmp(:eq, bits, LLVM::Int64.from_i(FalseValue), "is_falsy")
+  end
+
   def eval_build(&b)
     build.instance_eval(&b)
   end
@@ -118,9 +145,13 @@ class CodegenContext
       last_method = @current_method
       begin
 	@current_method = MethodRef.new(@module, fn, env, target, argc, argv)
-	using_self(target) do
-	  yield @current_method
-        end
+	# the landing pads of any begin-stmt around this definition belong
+	# to another function,
+	eh_begin(nil) do
+	  using_self(target) do
+	    yield @current_method
+	  end
+	end
       ensure
 	@current_method = last_method
       end
@@ -172,7 +203,26 @@ class CodegenContext
     end
   end
 
+  # creates the String objects for all the literals seen by codegen so far,
+  # registering the globals that refer to them as gc roots
+  def build_literals_init_fn
+    @module.functions.add("pup_literals_init", [EnvPtrType], LLVM.Void) do |fn, env|
+      env.name = "env"
+      fn.linkage = :internal
+      with_builder_at_end(fn.basic_blocks.append("entry")) do |b|
+	@string_literals.each do |value, global|
+	  src_ptr = global_string_constant(value, "litstr_#{global.name}")
+	  str = b.call(@module.functions["pup_string_new_literal"], env, src_ptr)
+	  b.store(str, global)
+	  b.call(@module.functions["pup_env_register_root"], env, global)
+	end
+	b.ret_void
+      end
+    end
+  end
+
   def build_real_main_fn
+    literals_init = build_literals_init_fn
     @module.functions.add("main", [LLVM::Int32, LLVM.Pointer(CStrType)], LLVM::Int32) do |mainfn, argc, argv|
       argc.name = "argc"
       argv.name = "argv"
@@ -181,6 +231,7 @@ class CodegenContext
       exit_block = mainfn.basic_blocks.append("exit")
       with_builder_at_end(entry) do |b|
         env = build_call.pup_runtime_env_create()
+        b.call(literals_init, env)
 
 	@current_method = Struct::FakeMethod.new(env)
 
@@ -196,6 +247,8 @@ class CodegenContext
 	b.br(exit_block)
       end
       with_builder_at_end(exit_block) do |b|
+	# writes out any buffered output, among other things
+	build_call.pup_runtime_env_destroy(current_method.env)
 	b.ret(LLVM::Int32.from_i(0))
       end
     end
@@ -238,12 +291,31 @@ class CodegenContext
     @global_sugar
   end
 
-  def eh_begin(landingpad)
+  # The rescue-blocks of the innermost begin-stmt in the current method, as
+  # the block that tests the exception's type against them and the slot the
+  # exception must be stored into first.  A raise within the begin-block
+  # can branch straight there, rather than unwinding.
+  LocalRescue = Struct.new(:dispatch_block, :excep_slot)
+
+  def eh_begin(landingpad, local_rescue=nil)
     last_landingpad = @landingpad
+    last_local_rescue = @local_rescue
     @landingpad = landingpad
+    @local_rescue = local_rescue
     yield 
   ensure
     @landingpad = last_landingpad
+    @local_rescue = last_local_rescue
+  end
+
+  def local_rescue?
+    !@local_rescue.nil?
+  end
+
+  # hands 'excep' to the rescue-blocks of the innermost begin-stmt,
+  def build_local_rescue_branch(excep)
+    build.store(excep, @local_rescue.excep_slot)
+    build.br(@local_rescue.dispatch_block)
   end
 
   def eh_handle(excep)
@@ -268,6 +340,29 @@ class CodegenContext
     catchall
   end
 
+  # Runs LLVM's optimisations over the module; 'level' is as for llc's -O
+  # option.  The GC's stack roots survive this, as mem2reg and GVN leave
+  # alone any alloca whose address is given to llvm.gcroot.
+  def optimise(level)
+    return if level == 0
+    # (the engine provides the pass manager with the target's data layout)
+    LLVM.init_x86
+    engine = LLVM::JITCompiler.new(@module)
+    passes = LLVM::PassManager.new(engine)
+    passes.mem2reg!
+    passes.instcombine!
+    passes.simplifycfg!
+    if level >= 2
+      passes.inline!
+      passes.gvn!
+      passes.licm!
+      passes.instcombine!
+      passes.simplifycfg!
+    end
+    passes.run(@module)
+    passes.dispose
+  end
+
   # Makes an LLVM Int from name.to_sym.to_i
   def mk_sym(name)
     ret = build_call.pup_env_str_to_sym(current_method.env, global_string_constant(name))
@@ -0,0 +1,42 @@
+#ifndef _CORE_SYMS_H
+#define _CORE_SYMS_H
+
+/*
+ * Symbols the runtime itself uses, which every symbol table starts with
+ * (see pup_sym_table_create()), so that their ids are compile-time
+ * constants and the runtime's method tables can be static data.
+ */
+enum PupCoreSym {
+	PUP_SYM_NEW = 1,
+	PUP_SYM_ALLOCATE,
+	PUP_SYM_INITIALIZE,
+	PUP_SYM_TO_S,
+	PUP_SYM_RAISE,
+	PUP_SYM_PUTS,
+	PUP_SYM_OP_EQUALS,
+	PUP_SYM_OP_PLUS,
+	PUP_SYM_OP_LESSTHAN,
+	PUP_SYM_OP_APPEND,
+	PUP_SYM_DUP,
+	PUP_SYM_LENGTH,
+	PUP_SYM_HASH,
+	PUP_SYM_MESSAGE,
+	PUP_SYM_BACKTRACE,
+	PUP_SYM_STAT,
+	PUP_SYM_IV_MESSAGE,
+	PUP_SYM_OBJECT,
+	PUP_SYM_CLASS,
+	PUP_SYM_STRING,
+	PUP_SYM_EXCEPTION,
+	PUP_SYM_STANDARDERROR,
+	PUP_SYM_RUNTIMEERROR,
+	PUP_SYM_NILCLASS,
+	PUP_SYM_TRUECLASS,
+	PUP_SYM_FALSECLASS,
+	PUP_SYM_FIXNUM,
+	PUP_SYM_GC,
+	// one more than the last of the above
+	PUP_CORE_SYM_END
+};
+
+#endif  // _CORE_SYMS_H
@@ -1,6 +1,8 @@
 #ifndef _CORE_TYPES_H
 #define _CORE_TYPES_H
 
+#include <stdint.h>
+
 struct PupObject;
 
 struct RuntimeEnv;
@@ -10,4 +12,17 @@ typedef struct PupObject *(PupMethod)(ENV, struct PupObject *, long, struct PupO
 
 struct PupClass;
 
+// nil, false and true aren't objects in memory but 'immediate' values,
+// which can't be mistaken for the address of a real (8-byte aligned)
+// object.  nil and false, the only falsy values, differ only in bit 2, so
+// a falsy test is a single compare.  (Generated code relies on these
+// values too, see core_types.rb.)
+#define PUP_NIL ((struct PupObject *)0x2)
+#define PUP_FALSE ((struct PupObject *)0x6)
+#define PUP_TRUE ((struct PupObject *)0xa)
+
+#define PUP_IS_IMMEDIATE(obj) (((uintptr_t)(obj) & 2) != 0)
+#define PUP_IS_FALSY(obj) (((uintptr_t)(obj) | 4) == 6)
+#define PUP_BOOL(cond) ((cond) ? PUP_TRUE : PUP_FALSE)
+
 #endif
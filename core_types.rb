@@ -14,6 +14,12 @@ SymbolType = LLVM::Int
 ObjectType = LLVM::Struct("PupObject")
 ObjectPtrType = ObjectType.pointer
 
+# nil, true and false aren't objects, but these values of an ObjectPtrType
+# (see core_types.h)
+NilValue = 0x2
+FalseValue = 0x6
+TrueValue = 0xa
+
 ArgsType = ObjectPtrType.pointer
 
 EnvType = LLVM.Struct("PupEnv")
@@ -58,9 +64,19 @@ IntObjectType = LLVM.Struct(
   LLVM::Int
 )
 
+# for flat strings, the characters follow inline, NUL terminated (see
+# struct PupString)
 StringObjectType = LLVM.Struct(
   ObjectType,
-  CStrType
+  LLVM::Int64,  # length
+  LLVM::Int64,  # hash
+  LLVM::Int32,  # frozen
+  LLVM::Int32,  # repr
+  LLVM.Pointer(LLVM::Int8),  # bytes
+  LLVM::Int64,  # capacity
+  LLVM.Pointer(ObjectType),  # left
+  LLVM.Pointer(ObjectType),  # right
+  LLVM::Array(LLVM::Int8, 0)
 )
 
 
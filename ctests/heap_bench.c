@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../heap.h"
+#include "../abortf.h"
+
+// Compares heap throughput with regions backed by normal 4KB pages against
+// regions backed by 2MB transparent huge pages (PUP_HEAP_HUGE_PAGES).  Each
+// configuration runs in its own child process, since the heap reads its
+// settings at pup_heap_init().
+//
+//  - 'alloc' is mutator throughput; allocating and initialising objects
+//  - 'trace' follows a randomly ordered chain through every object, as
+//    marking would
+//  - 'copy' evacuates every object into freshly allocated memory, as the
+//    copying phase of the collector would
+//
+// The mutator never reaches a safepoint, so the collector never gets past
+// its first handshake and every object stays live for the whole run.
+// Run with 2>/dev/null to discard the heap's diagnostic output.
+
+#define OBJECT_COUNT 2000000
+#define OBJECT_SIZE 48
+
+struct BenchObject {
+	struct BenchObject *next;
+	long payload[(OBJECT_SIZE - sizeof(void *)) / sizeof(long)];
+};
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct BenchObject *alloc_object(struct PupHeap *heap)
+{
+	struct BenchObject *obj = pup_heap_alloc(heap,
+	                                         sizeof(struct BenchObject),
+	                                         PUP_KIND_ATTR);
+	ABORT_ON(!obj, "pup_heap_alloc() gave NULL");
+	return obj;
+}
+
+static void shuffle(struct BenchObject **objs, long count)
+{
+	for (long i=count-1; i>0; i--) {
+		long j = random() % (i + 1);
+		struct BenchObject *tmp = objs[i];
+		objs[i] = objs[j];
+		objs[j] = tmp;
+	}
+}
+
+static void run_bench(const char *name)
+{
+	struct PupHeap heap;
+	int res = pup_heap_init(&heap);
+	ABORTF_ON(res, "pup_heap_init() failed with %d", res);
+	struct BenchObject **objs = malloc(OBJECT_COUNT * sizeof(*objs));
+	ABORT_ON(!objs, "malloc() failed");
+
+	double start = now();
+	for (long i=0; i<OBJECT_COUNT; i++) {
+		objs[i] = alloc_object(&heap);
+		memset(objs[i], 0, sizeof(struct BenchObject));
+	}
+	double alloc_time = now() - start;
+
+	shuffle(objs, OBJECT_COUNT);
+	for (long i=0; i<OBJECT_COUNT-1; i++) {
+		objs[i]->next = objs[i+1];
+	}
+	start = now();
+	long visited = 0;
+	for (struct BenchObject *obj=objs[0]; obj; obj=obj->next) {
+		visited++;
+	}
+	double trace_time = now() - start;
+	ABORT_ON(visited != OBJECT_COUNT, "chain is broken");
+
+	start = now();
+	for (long i=0; i<OBJECT_COUNT; i++) {
+		struct BenchObject *copy = alloc_object(&heap);
+		memcpy(copy, objs[i], sizeof(struct BenchObject));
+	}
+	double copy_time = now() - start;
+
+	printf("%-12s %12.1f %12.1f %12.1f\n", name,
+	       OBJECT_COUNT / alloc_time / 1e6,
+	       OBJECT_COUNT / trace_time / 1e6,
+	       OBJECT_COUNT / copy_time / 1e6);
+	// see above; the collector may be waiting on us, so we don't try to
+	// pup_heap_destroy()
+}
+
+static void run_child(const char *name, bool huge_pages)
+{
+	// don't let the child inherit (and re-print) buffered output,
+	fflush(stdout);
+	pid_t pid = fork();
+	ABORT_ON(pid < 0, "fork() failed");
+	if (pid == 0) {
+		// room for the objects and their copies,
+		setenv("PUP_HEAP_MAX_MB", "512", 1);
+		if (huge_pages) {
+			setenv("PUP_HEAP_HUGE_PAGES", "1", 1);
+		} else {
+			unsetenv("PUP_HEAP_HUGE_PAGES");
+		}
+		srandom(1);
+		run_bench(name);
+		fflush(stdout);
+		_exit(0);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	ABORT_ON(!WIFEXITED(status) || WEXITSTATUS(status),
+	         "benchmark child failed");
+}
+
+int main(int argc, char **argv)
+{
+	printf("%-12s %12s %12s %12s\n", "pages",
+	       "alloc (M/s)", "trace (M/s)", "copy (M/s)");
+	run_child("4KB", false);
+	run_child("2MB THP", true);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "../gc.h"
+#include "../abortf.h"
+
+// Measures the time taken by pup_gc_scan_stack() as the depth of the stack
+// increases, for both the frame-pointer walker and the libunwind walker.
+// Run with 2>/dev/null to discard the GC's diagnostic output.
+
+#define SCANS_PER_DEPTH 200
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double time_scans(struct PupGCState *state)
+{
+	double start = now();
+	for (int i=0; i<SCANS_PER_DEPTH; i++) {
+		pup_gc_scan_stack(state);
+	}
+	return (now() - start) / SCANS_PER_DEPTH;
+}
+
+static double scan_at_depth(struct PupGCState *state, int depth)
+{
+	if (depth > 0) {
+		double t = scan_at_depth(state, depth - 1);
+		return t;
+	}
+	return time_scans(state);
+}
+
+static struct PupGCState *create_state(bool unwind_stack)
+{
+	if (unwind_stack) {
+		setenv("PUP_GC_UNWIND_STACK", "1", 1);
+	} else {
+		unsetenv("PUP_GC_UNWIND_STACK");
+	}
+	struct PupGCState *state = pup_gc_state_create(NULL);
+	ABORT_ON(!state, "pup_gc_state_create() failed");
+	return state;
+}
+
+int main(int argc, char **argv)
+{
+	struct PupGCState *fp_state = create_state(false);
+	struct PupGCState *unwind_state = create_state(true);
+	printf("%8s %16s %16s\n", "depth", "frame-ptr (us)", "libunwind (us)");
+	for (int depth=1; depth<=10000; depth*=10) {
+		double fp_time = scan_at_depth(fp_state, depth);
+		double unwind_time = scan_at_depth(unwind_state, depth);
+		printf("%8d %16.2f %16.2f\n", depth,
+		       fp_time * 1e6, unwind_time * 1e6);
+	}
+	pup_gc_state_destroy(unwind_state);
+	pup_gc_state_destroy(fp_state);
+	return 0;
+}
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "../env.h"
+#include "../object.h"
+#include "../string.h"
+#include "../abortf.h"
+
+// Builds strings of increasing size from small pieces, comparing
+//
+//  - 'naive', a new String holding a copy of everything so far for each
+//    piece, as concatenation via pup_string_new_cstr() would be
+//  - 'plus', s = s + piece, which builds a rope
+//  - 'append', s << piece, which appends into a capacity-doubling buffer
+//
+// Timings include getting the final C string value (flattening the rope).
+// The naive case is quadratic, so is only run for the smaller sizes.
+//
+// The mutator never reaches a safepoint, so the collector never gets past
+// its first handshake and nothing is freed during the run.
+// Run with 2>/dev/null to discard the heap's diagnostic output.
+
+#define PIECE_SIZE 16
+#define NAIVE_MAX_SIZE (64 * 1024)
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *naive(ENV, struct PupObject *piece, long count)
+{
+	struct PupObject *s = pup_string_new_cstr(env, "");
+	for (long i=0; i<count; i++) {
+		const char *a = pup_string_value(env, s);
+		const char *b = pup_string_value(env, piece);
+		size_t a_len = strlen(a);
+		char *tmp = malloc(a_len + PIECE_SIZE + 1);
+		ABORT_ON(!tmp, "malloc() failed");
+		memcpy(tmp, a, a_len);
+		memcpy(tmp + a_len, b, PIECE_SIZE + 1);
+		s = pup_string_new_cstr(env, tmp);
+		free(tmp);
+	}
+	return pup_string_value(env, s);
+}
+
+static const char *build(ENV,
+                         char *method,
+                         struct PupObject *piece,
+                         long count)
+{
+	long sym = pup_env_str_to_sym(env, method);
+	struct PupObject *s = pup_string_new_cstr(env, "");
+	for (long i=0; i<count; i++) {
+		s = pup_invoke(env, s, sym, 1, &piece);
+	}
+	return pup_string_value(env, s);
+}
+
+static void check(const char *result, const char *expected, const char *name)
+{
+	ABORTF_ON(strcmp(result, expected), "%s gave the wrong string", name);
+}
+
+int main(int argc, char **argv)
+{
+	// room for all the garbage,
+	setenv("PUP_HEAP_MAX_MB", "1024", 1);
+	struct RuntimeEnv *env = pup_runtime_env_create();
+	ABORT_ON(!env, "pup_runtime_env_create() failed");
+	struct PupObject *piece = pup_string_new_cstr(env, "0123456789abcdef");
+
+	printf("%-10s %12s %12s %12s\n", "size", "naive(ms)", "plus(ms)",
+	       "append(ms)");
+	for (long size=16*1024; size<=1024*1024; size*=4) {
+		long count = size / PIECE_SIZE;
+		char *expected = malloc(size + 1);
+		ABORT_ON(!expected, "malloc() failed");
+		for (long i=0; i<count; i++) {
+			memcpy(expected + i * PIECE_SIZE, "0123456789abcdef",
+			       PIECE_SIZE);
+		}
+		expected[size] = '\0';
+
+		char naive_ms[16] = "-";
+		if (size <= NAIVE_MAX_SIZE) {
+			double start = now();
+			const char *result = naive(env, piece, count);
+			snprintf(naive_ms, sizeof(naive_ms), "%.2f",
+			         (now() - start) * 1e3);
+			check(result, expected, "naive");
+		}
+		double start = now();
+		const char *result = build(env, "+", piece, count);
+		double plus_time = now() - start;
+		check(result, expected, "plus");
+		start = now();
+		result = build(env, "<<", piece, count);
+		double append_time = now() - start;
+		check(result, expected, "append");
+
+		printf("%-10ld %12s %12.2f %12.2f\n", size, naive_ms,
+		       plus_time * 1e3, append_time * 1e3);
+		free(expected);
+	}
+	// see above; the collector may be waiting on us, so we don't try to
+	// pup_runtime_env_destroy()
+	return 0;
+}
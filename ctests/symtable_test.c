@@ -1,7 +1,9 @@
 
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include "../symtable.h"
+#include "../core_syms.h"
 #include "../abortf.h"
 
 int main(int argc, char **argv)
@@ -23,6 +25,19 @@ int main(int argc, char **argv)
 	ABORT_ON(!pup_get_sym(st, "barblat", &tmp_sym),
 	         "symbol retreval failed");
 	ABORT_ON(tmp_sym != barblat_sym, "symbol value missmatch");
+	ABORT_ON(pup_str_to_sym(st, "initialize") != PUP_SYM_INITIALIZE,
+	         "core symbol value missmatch");
+	pup_sym_table_destroy(st);
+
+	static const char *const preloaded[] = { "foobar", "barblat" };
+	st = pup_sym_table_create_preloaded(preloaded, 2);
+	ABORT_ON(pup_str_to_sym(st, "barblat") != 2,
+	         "preloaded symbol value missmatch");
+	int blatfoo_sym = pup_str_to_sym(st, "blatfoo");
+	ABORTF_ON(blatfoo_sym != 3, "expected 3, got %d", blatfoo_sym);
+	ABORT_ON(strcmp(pup_sym_to_str(st, 1), "foobar"),
+	         "preloaded symbol string missmatch");
+	ABORT_ON(pup_sym_table_count(st) != 3, "symbol count missmatch");
 	pup_sym_table_destroy(st);
 	return 0;
 }
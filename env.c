@@ -1,15 +1,22 @@
 
 #include <stdlib.h>
+#include <string.h>
 #include "core_types.h"
 #include "symtable.h"
+#include "core_syms.h"
 #include "object.h"
 #include "class.h"
 #include "string.h"
 #include "exception.h"
 #include "heap.h"
 #include "fixnum.h"
+#include "gcstat.h"
+#include "io.h"
+#include "raise.h"
+#include "image.h"
 #include "abortf.h"
 #include "stdio.h"
+#include <atomic_ops.h>
 
 struct RuntimeEnv {
 	struct PupHeap heap;
@@ -20,24 +27,24 @@ struct RuntimeEnv {
 	struct PupClass *class_exception;
 	struct PupClass *class_standarderror;
 	struct PupClass *class_runtimeerror;
+	struct PupClass *class_nil;
 	struct PupClass *class_true;
 	struct PupClass *class_false;
-	struct PupObject *object_true;
-	struct PupObject *object_false;
 	struct PupClass *class_fixnum;
+	struct PupObject *object_gc;
 };
 
 
 void pup_runtime_env_destroy(struct RuntimeEnv *env)
 {
+	pup_io_flush_all();
 	if (env->sym_tab) {
 		pup_sym_table_destroy(env->sym_tab);
 	}
 	/*
-	pup_object_free(env->object_false);
-	pup_object_free(env->object_true);
 	pup_class_free(env->class_false);
 	pup_class_free(env->class_true);
+	pup_class_free(env->class_nil);
 	pup_class_free(env->class_runtimeerror);
 	pup_class_free(env->class_standarderror);
 	pup_class_free(env->class_exception);
@@ -49,72 +56,152 @@ void pup_runtime_env_destroy(struct RuntimeEnv *env)
 	free(env);
 }
 
-static void runtime_init(struct RuntimeEnv *env)
+// defined by runtime_image.o, for programs linked with a runtime image,
+extern const struct PupImage pup_runtime_image __attribute__((weak));
+// set once an env has been created from pup_runtime_image,
+static volatile AO_t image_claimed = false;
+
+#define ENV_ROOT_COUNT 11
+
+// the objects the runtime keeps references to itself,
+static void get_env_roots(struct RuntimeEnv *env,
+                          struct PupObject **roots[ENV_ROOT_COUNT])
+{
+	struct PupObject **env_roots[ENV_ROOT_COUNT] = {
+		(struct PupObject **)&env->class_object,
+		(struct PupObject **)&env->class_class,
+		(struct PupObject **)&env->class_string,
+		(struct PupObject **)&env->class_exception,
+		(struct PupObject **)&env->class_standarderror,
+		(struct PupObject **)&env->class_runtimeerror,
+		(struct PupObject **)&env->class_nil,
+		(struct PupObject **)&env->class_true,
+		(struct PupObject **)&env->class_false,
+		(struct PupObject **)&env->class_fixnum,
+		&env->object_gc
+	};
+	memcpy(roots, env_roots, sizeof(env_roots));
+}
+
+static void register_roots(struct RuntimeEnv *env)
+{
+	struct PupObject **roots[ENV_ROOT_COUNT];
+	get_env_roots(env, roots);
+	for (int i=0; i<ENV_ROOT_COUNT; i++) {
+		pup_env_register_root(env, roots[i]);
+	}
+}
+
+static void runtime_init_common(struct RuntimeEnv *env)
 {
 	if (pup_heap_init(&env->heap)) {
 		ABORTF("heap initialization failed");
 	}
+	pup_io_init();
+	pup_raise_init();
+}
+
+// Takes the core classes and objects from the program's runtime image,
+// rather than bootstrapping them, returning false if there's no image (or
+// it's already in use by another env)
+static bool runtime_init_from_image(struct RuntimeEnv *env)
+{
+	const struct PupImage *image = &pup_runtime_image;
+	if (!image || !AO_compare_and_swap(&image_claimed, false, true)) {
+		return false;
+	}
+	ABORTF_ON(image->env_root_count != ENV_ROOT_COUNT
+	          || image->symbol_count < PUP_CORE_SYM_END - 1,
+	          "runtime image isn't from this build of the runtime");
+	env->sym_tab = pup_sym_table_create_preloaded(image->symbols,
+	                                              image->symbol_count);
+	ABORT_ON(!env->sym_tab, "pup_sym_table_create_preloaded() failed");
+	runtime_init_common(env);
+	struct PupObject **roots[ENV_ROOT_COUNT];
+	get_env_roots(env, roots);
+	for (int i=0; i<ENV_ROOT_COUNT; i++) {
+		*roots[i] = pup_image_object(image, image->env_roots[i]);
+	}
+	for (int i=0; i<image->object_count; i++) {
+		pup_heap_add_root_object(&env->heap,
+		                         pup_image_object(image,
+		                                          image->objects[i]));
+	}
+	register_roots(env);
+	return true;
+}
+
+static void runtime_init(struct RuntimeEnv *env)
+{
+	runtime_init_common(env);
 	env->class_object = pup_bootstrap_create_classobject(env);
 	env->class_class = pup_bootstrap_create_classclass(env,
 	                                                   env->class_object);  // super=Object
 	obj_init((struct PupObject *)env->class_object, env->class_class);
 	obj_init((struct PupObject *)env->class_class, env->class_class);
-	pup_class_class_init(env, env->class_object);
+	pup_class_class_init(env, env->class_class);
 	pup_object_class_init(env, env->class_object);
 
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "Object"),
+	              PUP_SYM_OBJECT,
 	              (struct PupObject *)env->class_object);
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "Class"),
+	              PUP_SYM_CLASS,
 	              (struct PupObject *)env->class_class);
 	env->class_string = pup_bootstrap_create_classstring(env);
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "String"),
+	              PUP_SYM_STRING,
 	              (struct PupObject *)env->class_string);
-	env->class_exception = pup_create_class(env,
-	                                        env->class_object,
-	                                        NULL,  // no lexical scope
-	                                        "Exception");
+	env->class_exception = pup_bootstrap_create_classexception(env);
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "Exception"),
+	              PUP_SYM_EXCEPTION,
 	              (struct PupObject *)env->class_exception);
 	env->class_standarderror = pup_create_class(env,
 	                                            env->class_exception,
 	                                            NULL,  // no lexical scope
 	                                            "StandardError");
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "StandardError"),
+	              PUP_SYM_STANDARDERROR,
 	              (struct PupObject *)env->class_standarderror);
 	env->class_runtimeerror = pup_create_class(env,
 	                                           env->class_standarderror,
 	                                           NULL,  // no lexical scope
 	                                           "RuntimeError");
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "RuntimeError"),
+	              PUP_SYM_RUNTIMEERROR,
 	              (struct PupObject *)env->class_runtimeerror);
+	env->class_nil = pup_create_class(env,
+	                                  env->class_object,
+	                                  NULL,  // no lexical scope
+	                                  "NilClass");
+	pup_const_set(env, env->class_object,
+	              PUP_SYM_NILCLASS,
+	              (struct PupObject *)env->class_nil);
 	env->class_true = pup_create_class(env,
 	                                        env->class_object,
 	                                        NULL,  // no lexical scope
 	                                        "TrueClass");
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "TrueClass"),
+	              PUP_SYM_TRUECLASS,
 	              (struct PupObject *)env->class_true);
 	env->class_false = pup_create_class(env,
 	                                        env->class_object,
 	                                        NULL,  // no lexical scope
 	                                        "FalseClass");
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "FalseClass"),
+	              PUP_SYM_FALSECLASS,
 	              (struct PupObject *)env->class_false);
-	env->object_true = pup_create_object(env, env->class_true);
-	env->object_false = pup_create_object(env, env->class_false);
 
 	pup_exception_class_init(env, env->class_exception);
 	env->class_fixnum = pup_bootstrap_create_classfixnum(env);
 	pup_const_set(env, env->class_object,
-	              pup_env_str_to_sym(env, "Fixnum"),
+	              PUP_SYM_FIXNUM,
 	              (struct PupObject *)env->class_fixnum);
+	env->object_gc = pup_bootstrap_create_gc_object(env);
+	pup_const_set(env, env->class_object,
+	              PUP_SYM_GC,
+	              env->object_gc);
+	register_roots(env);
 }
 
 struct RuntimeEnv *pup_runtime_env_create()
@@ -123,6 +210,9 @@ struct RuntimeEnv *pup_runtime_env_create()
 	if (!env) {
 		return NULL;
 	}
+	if (runtime_init_from_image(env)) {
+		return env;
+	}
 	env->sym_tab = pup_sym_table_create();
 	if (!env->sym_tab) {
 		goto error;
@@ -177,14 +267,19 @@ const char *pup_env_sym_to_str(ENV, const int sym)
 	return pup_sym_to_str(env->sym_tab, sym);
 }
 
-struct PupObject *pup_env_get_trueinstance(ENV)
+struct PupClass *pup_env_get_classnil(ENV)
+{
+	return env->class_nil;
+}
+
+struct PupClass *pup_env_get_classtrue(ENV)
 {
-	return env->object_true;
+	return env->class_true;
 }
 
-struct PupObject *pup_env_get_falseinstance(ENV)
+struct PupClass *pup_env_get_classfalse(ENV)
 {
-	return env->object_false;
+	return env->class_false;
 }
 
 struct PupClass *pup_env_get_classfixnum(ENV)
@@ -202,6 +297,11 @@ void *pup_alloc_attr(ENV, size_t size)
 	return pup_heap_alloc(&env->heap, size, PUP_KIND_ATTR);
 }
 
+void *pup_alloc_permanent_obj(ENV, size_t size)
+{
+	return pup_heap_alloc_permanent(&env->heap, size, PUP_KIND_OBJ);
+}
+
 void *pup_env_alloc_obj_for_gc_copy(ENV, size_t size)
 {
 	return pup_heap_alloc_for_gc_copy(&env->heap, size, PUP_KIND_OBJ);
@@ -225,7 +325,7 @@ static void *do_main(void *arg)
 	pup_heap_thread_init(&args->env->heap);
 	struct PupObject *ret =
 		(*args->main_method)(args->env, args->main_obj, 0, NULL);
-	// TODO: pup_heap_thread_destroy(), or something named better
+	pup_heap_thread_exit(&args->env->heap);
 	return ret;
 }
 
@@ -251,10 +351,15 @@ int pup_env_launch_main(ENV, PupMethod *main_method)
 	                         (void *)&args);
 	// FIXME: proper error handling
 	ABORTF_ON(res, "pthread_create() returned %d", res);
-	void *retval;
-	res = pthread_join(main_thread, &retval);
+	// this thread set up the heap, and so is a mutator too; it leaves the
+	// heap while it waits, rather than have the collector wait on it
+	pup_heap_thread_exit(&env->heap);
+	res = pthread_join(main_thread, NULL);
 	// FIXME: proper error handling
 	ABORTF_ON(res, "pthread_join() returned %d", res);
+	// ...and rejoins it afterwards, as pup_heap_destroy() expects
+	res = pup_heap_thread_init(&env->heap);
+	ABORTF_ON(res, "pup_heap_thread_init() returned %d", res);
 	return 0;
 }
 
@@ -262,3 +367,35 @@ void pup_env_safepoint(ENV)
 {
 	pup_heap_safepoint(&env->heap);
 }
+
+void pup_env_pre_write_barrier(ENV, struct PupObject *old_value)
+{
+	pup_heap_pre_write_barrier(&env->heap, old_value);
+}
+
+void pup_env_get_gc_stats(ENV, struct PupGCStats *stats)
+{
+	pup_heap_get_gc_stats(&env->heap, stats);
+}
+
+int pup_env_backtrace(ENV, void **addrs, int max)
+{
+	return pup_heap_backtrace(&env->heap, addrs, max);
+}
+
+void pup_env_register_root(ENV, struct PupObject **root)
+{
+	pup_heap_add_root(&env->heap, (void **)root);
+}
+
+void pup_env_write_image(ENV, FILE *out)
+{
+	struct PupObject **roots[ENV_ROOT_COUNT];
+	get_env_roots(env, roots);
+	struct PupObject *root_objs[ENV_ROOT_COUNT];
+	for (int i=0; i<ENV_ROOT_COUNT; i++) {
+		root_objs[i] = *roots[i];
+	}
+	pup_image_write(env, &env->heap, out, root_objs, ENV_ROOT_COUNT,
+	                env->sym_tab);
+}
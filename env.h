@@ -1,7 +1,10 @@
 
 #include <stdlib.h>
+#include <stdio.h>
 #include "core_types.h"
 
+struct PupGCStats;
+
 void pup_runtime_env_destroy(struct RuntimeEnv *env);
 struct RuntimeEnv *pup_runtime_env_create();
 
@@ -10,8 +13,10 @@ struct PupClass *pup_env_get_classclass(ENV);
 struct PupClass *pup_env_get_classstring(ENV);
 struct PupClass *pup_env_get_classexception(ENV);
 struct PupClass *pup_env_get_classruntimeerror(ENV);
-struct PupObject *pup_env_get_trueinstance(ENV);
-struct PupObject *pup_env_get_falseinstance(ENV);
+// the classes of the immediates PUP_NIL, PUP_TRUE and PUP_FALSE,
+struct PupClass *pup_env_get_classnil(ENV);
+struct PupClass *pup_env_get_classtrue(ENV);
+struct PupClass *pup_env_get_classfalse(ENV);
 struct PupClass *pup_env_get_classfixnum(ENV);
 
 int pup_env_str_to_sym(ENV, char *str);
@@ -19,5 +24,28 @@ const char *pup_env_sym_to_str(ENV, const int sym);
 
 void *pup_alloc_obj(ENV, size_t size);
 void *pup_alloc_attr(ENV, size_t size);
+void *pup_alloc_permanent_obj(ENV, size_t size);
 void *pup_env_alloc_obj_for_gc_copy(ENV, size_t size);
 void *pup_env_alloc_attr_for_gc_copy(ENV, size_t size);
+
+void pup_env_pre_write_barrier(ENV, struct PupObject *old_value);
+
+void pup_env_get_gc_stats(ENV, struct PupGCStats *stats);
+
+/**
+ * Records the return addresses of (up to 'max' of) the pup frames on the
+ * calling thread's stack, innermost first, returning how many there were.
+ */
+int pup_env_backtrace(ENV, void **addrs, int max);
+
+/**
+ * Registers a location holding an object reference (e.g. a global) which
+ * the collector must treat as a root.
+ */
+void pup_env_register_root(ENV, struct PupObject **root);
+
+/**
+ * Writes out the env's objects and symbols as a runtime image (see
+ * image.h), for an env just created by pup_runtime_env_create().
+ */
+void pup_env_write_image(ENV, FILE *out);
@@ -1,15 +1,19 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <dlfcn.h>
 //#include <libunwind.h>
 #include "abortf.h"
 #include "core_types.h"
 #include "runtime.h"
 #include "class.h"
+#include "core_syms.h"
 #include "raise.h"
 #include "string.h"
 #include "object.h"
+#include "io.h"
 
 /*
 static void dump_stack()
@@ -34,24 +38,93 @@ static void dump_stack()
 }
 */
 
+// enough frames to show the way to a raise, while keeping both the raise
+// and each exception object cheap
+#define BACKTRACE_MAX 16
+
+struct PupException {
+	struct PupObject obj_header;
+	// return addresses of the pup frames the exception was first raised
+	// from, innermost first; only turned into names if someone asks
+	int backtrace_length;
+	void *backtrace[BACKTRACE_MAX];
+};
+
+struct PupObject *pup_exception_allocate_instance(ENV, struct PupClass *type)
+{
+	struct PupException *ex = pup_alloc_obj(env, sizeof(struct PupException));
+	obj_init((struct PupObject *)ex, type);
+	ex->backtrace_length = 0;
+	return (struct PupObject *)ex;
+}
+
+void pup_exception_destroy_instance(struct PupObject *obj)
+{
+	pup_object_destroy_instance(obj);
+}
+
+struct PupObject *pup_exception_gc_copy_instance(ENV, const struct PupObject *obj)
+{
+	struct PupException *new_ex
+		= pup_env_alloc_obj_for_gc_copy(env, sizeof(struct PupException));
+	memcpy(new_ex, obj, sizeof(struct PupException));
+	return (struct PupObject *)new_ex;
+}
+
+struct PupClass *pup_bootstrap_create_classexception(ENV)
+{
+	return pup_internal_create_class(env,
+	                                 pup_env_get_classobject(env),
+	                                 NULL,  // no lexical scope
+	                                 "Exception",
+	                                 &pup_exception_allocate_instance,
+	                                 &pup_exception_destroy_instance,
+	                                 &pup_exception_gc_copy_instance);
+}
+
+// a re-raise keeps the backtrace of the original raise
+static void record_backtrace(ENV, struct PupObject *obj)
+{
+	struct PupException *ex = (struct PupException *)obj;
+	if (!ex->backtrace_length) {
+		ex->backtrace_length = pup_env_backtrace(env, ex->backtrace,
+		                                         BACKTRACE_MAX);
+	}
+}
+
+// e.g. "pup_method__parse_3+0x2f"
+static void format_frame(void *addr, char *buf, size_t size)
+{
+	Dl_info info;
+	if (dladdr(addr, &info) && info.dli_sname) {
+		snprintf(buf, size, "%s+0x%lx", info.dli_sname,
+		         (unsigned long)((char *)addr - (char *)info.dli_saddr));
+	} else {
+		snprintf(buf, size, "%p", addr);
+	}
+}
+
 void pup_exception_message_set(ENV,
                                struct PupObject *target,
                                struct PupObject *value)
 {
-	const int sym_message = pup_env_str_to_sym(env, "@message");
+	const int sym_message = PUP_SYM_IV_MESSAGE;
 	pup_iv_set(env, target, sym_message, value);
 }
 
 bool pup_instanceof_exception(ENV, struct PupObject *obj)
 {
-	return pup_object_instanceof(obj, pup_env_get_classexception(env));
+	return pup_object_instanceof(env, obj, pup_env_get_classexception(env));
 }
 
+// runtime errors are only made to be raised straight away, so their
+// backtraces are recorded as they are created
 struct PupObject *pup_new_runtimeerror(ENV, const char *message)
 {
 	ABORT_ON(!message, "message must not be null");
 	struct PupObject *e = pup_create_object(env, pup_env_get_classruntimeerror(env));
 	pup_exception_message_set(env, e, pup_string_new_cstr(env, message));
+	record_backtrace(env, e);
 	return e;
 }
 
@@ -61,9 +134,14 @@ struct PupObject *pup_new_runtimeerrorf(ENV, const char *messagefmt, ...)
 	struct PupObject *e = pup_create_object(env, pup_env_get_classruntimeerror(env));
 	char message[1024];
 	va_start(ap, messagefmt);
-	vsnprintf(message, sizeof(message), messagefmt, ap);
+	int length = vsnprintf(message, sizeof(message), messagefmt, ap);
 	va_end(ap);
-	pup_exception_message_set(env, e, pup_string_new_cstr(env, message));
+	if (length >= (int)sizeof(message)) {
+		// truncated,
+		length = sizeof(message) - 1;
+	}
+	pup_exception_message_set(env, e, pup_string_new(env, message, length));
+	record_backtrace(env, e);
 	return e;
 }
 
@@ -74,14 +152,14 @@ void pup_raise_runtimeerror(ENV, const char *message)
 
 struct PupObject *pup_exception_message_get(ENV, struct PupObject *target)
 {
-	const int sym_message = pup_env_str_to_sym(env, "@message");
+	const int sym_message = PUP_SYM_IV_MESSAGE;
 	return pup_iv_get(target, sym_message);
 }
 
 const char *exception_text(ENV, struct PupObject *ex)
 {
 	struct PupObject *msg = pup_exception_message_get(env, ex);
-	if (msg) {
+	if (msg != PUP_NIL) {
 		return pup_string_value(env, msg);
 	}
 	return pup_object_type_name(ex);
@@ -90,8 +168,16 @@ const char *exception_text(ENV, struct PupObject *ex)
 void pup_handle_uncaught_exception(ENV, const struct _Unwind_Exception *e)
 {
 	struct PupObject *ex = extract_exception_obj(e);
+	// so that the report comes after everything the program wrote,
+	pup_io_flush_all();
 	fprintf(stderr, "Uncaught %s: \"%s\"\n",
 	       pup_object_type_name((struct PupObject *)ex), exception_text(env, ex));
+	const struct PupException *pup_ex = (struct PupException *)ex;
+	for (int i=0; i<pup_ex->backtrace_length; i++) {
+		char frame[256];
+		format_frame(pup_ex->backtrace[i], frame, sizeof(frame));
+		fprintf(stderr, "\tfrom %s\n", frame);
+	}
 	exit(1);
 }
 
@@ -109,6 +195,26 @@ METH_IMPL(pup_exception_message)
 	return pup_exception_message_get(env, target);
 }
 
+// no Array yet, so the frames come as the lines of a String (nil if the
+// exception was never raised)
+METH_IMPL(pup_exception_backtrace)
+{
+	const struct PupException *ex = (struct PupException *)target;
+	if (!ex->backtrace_length) {
+		return PUP_NIL;
+	}
+	char buf[BACKTRACE_MAX * 256];
+	long length = 0;
+	for (int i=0; i<ex->backtrace_length; i++) {
+		if (i) {
+			buf[length++] = '\n';
+		}
+		format_frame(ex->backtrace[i], buf + length, 255);
+		length += strlen(buf + length);
+	}
+	return pup_string_new(env, buf, length);
+}
+
 METH_IMPL(pup_exception_initialize)
 {
 	if (argc == 1) {
@@ -116,33 +222,55 @@ METH_IMPL(pup_exception_initialize)
 	} else if (argc > 1) {
 		pup_arity_check(env, 1, argc);
 	}
-	return NULL;
+	return PUP_NIL;
 }
 
-// TODO move to Kernel class
-METH_IMPL(pup_object_raise)
+// the exception that raise(arg) raises,
+static struct PupObject *exception_for_raise(ENV, struct PupObject *arg)
 {
-	pup_arity_check(env, 1, argc);
-	struct PupObject *arg = argv[0];
-	if (pup_object_kindof(arg, pup_env_get_classexception(env))) {
-		pup_raise(arg);
-		abort();
+	if (pup_object_kindof(env, arg, pup_env_get_classexception(env))) {
+		record_backtrace(env, arg);
+		return arg;
 	}
 	if (pup_is_string(env, arg)) {
-		pup_raise_runtimeerror(env, pup_string_value_unsafe(arg));
-		abort();
+		// a literal message is used as it is, rather than copied
+		struct PupObject *e = pup_create_object(env, pup_env_get_classruntimeerror(env));
+		pup_exception_message_set(env, e, pup_string_frozen(env, arg));
+		record_backtrace(env, e);
+		return e;
 	}
 	// TODO exception classes
-	pup_raise_runtimeerror(env, "exception class/object expected");
+	return pup_new_runtimeerror(env, "exception class/object expected");
+}
+
+// TODO move to Kernel class
+METH_IMPL(pup_object_raise)
+{
+	pup_arity_check(env, 1, argc);
+	pup_raise(exception_for_raise(env, argv[0]));
 	abort();
 }
 
+struct PupObject *pup_exception_for_local_raise(ENV,
+                                                struct PupObject *target,
+                                                struct PupObject *arg)
+{
+	PupMethod *method = find_method_in_classes(pup_object_class(env, target),
+	                                           PUP_SYM_RAISE);
+	if (method != pup_object_raise) {
+		return NULL;
+	}
+	return exception_for_raise(env, arg);
+}
+
+const struct PupBuiltinMethod pup_exception_methods[] = {
+	{ PUP_SYM_INITIALIZE, pup_exception_initialize },
+	{ PUP_SYM_MESSAGE, pup_exception_message },
+	{ PUP_SYM_BACKTRACE, pup_exception_backtrace }
+};
+
 void pup_exception_class_init(ENV, struct PupClass *class_excep)
 {
-	pup_define_method(class_excep,
-	                  pup_env_str_to_sym(env, "initialize"),
-	                  pup_exception_initialize);
-	pup_define_method(class_excep,
-	                  pup_env_str_to_sym(env, "message"),
-	                  pup_exception_message);
+	pup_class_set_builtin_methods(class_excep, pup_exception_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_exception_methods));
 }
@@ -10,6 +10,23 @@ bool pup_instanceof_exception(ENV, struct PupObject *obj);
 // TODO move to Kernel class
 METH_IMPL(pup_object_raise);
 
+/**
+ * For a raise(arg) that generated code found within a begin-block whose
+ * rescue-blocks are in the same function: returns the exception that
+ * raise(arg) would raise, so that the code can branch straight to the
+ * rescue-blocks without unwinding.  Returns NULL if 'target' has some
+ * other raise method, which the code must then invoke as normal.
+ */
+struct PupObject *pup_exception_for_local_raise(ENV,
+                                                struct PupObject *target,
+                                                struct PupObject *arg);
+
+/**
+ * Creates the Exception class, whose instances have room to record where
+ * they were raised from.
+ */
+struct PupClass *pup_bootstrap_create_classexception(ENV);
+
 /*
  * Bootstrap the Exception class. Used while initialising runtime environment
  */
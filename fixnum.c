@@ -1,10 +1,12 @@
 
+#include <string.h>
 #include "env.h"
 #include "object.h"
 #include "raise.h"
 #include "exception.h"
 #include "core_types.h"
 #include "class.h"
+#include "core_syms.h"
 
 struct PupFixnum {
 	struct PupObject obj_header;
@@ -22,25 +24,34 @@ struct PupObject *pup_fixnum_create(ENV, int value)
 	return obj;
 }
 
-static struct PupObject *fixnum_allocate_instance(ENV, struct PupClass *type)
+struct PupObject *pup_fixnum_allocate_instance(ENV, struct PupClass *type)
 {
 	// this should really be impossible
 	pup_raise_runtimeerror(env, "you can't call 'new' on Fixnum");
 	abort();
 }
 
-static void fixnum_destroy_instance(struct PupObject *obj)
+void pup_fixnum_destroy_instance(struct PupObject *obj)
 {
 	// nothing to do
 }
 
+struct PupObject *pup_fixnum_gc_copy_instance(ENV,
+                                             const struct PupObject *obj)
+{
+	struct PupObject *new_obj =
+		pup_env_alloc_obj_for_gc_copy(env, sizeof(struct PupFixnum));
+	memcpy(new_obj, obj, sizeof(struct PupFixnum));
+	return new_obj;
+}
+
 METH_IMPL(pup_fixnum_plus)
 {
 	pup_arity_check(env, 1, argc);
 	struct PupObject *rhs = argv[0];
-	if (target->type != rhs->type) {
+	if (!pup_object_instanceof(env, rhs, target->type)) {
 		// TODO: TypeError
-		pup_raise(pup_new_runtimeerrorf(env, "%s can't be coerced into Fixnum", pup_type_name(rhs->type)));
+		pup_raise(pup_new_runtimeerrorf(env, "%s can't be coerced into Fixnum", pup_object_type_name(rhs)));
 		abort();
 	}
 	struct PupFixnum *left = (struct PupFixnum *)target;
@@ -53,13 +64,12 @@ METH_IMPL(pup_fixnum_op_equals)
 {
 	pup_arity_check(env, 1, argc);
 	struct PupObject *rhs = argv[0];
-	if (target->type != rhs->type) {
-		return pup_env_get_falseinstance(env);
+	if (!pup_object_instanceof(env, rhs, target->type)) {
+		return PUP_FALSE;
 	}
 	struct PupFixnum *left = (struct PupFixnum *)target;
 	struct PupFixnum *right = (struct PupFixnum *)rhs;
-	return left->value == right->value  ? pup_env_get_trueinstance(env)
-	                                    : pup_env_get_falseinstance(env);
+	return PUP_BOOL(left->value == right->value);
 
 }
 
@@ -67,33 +77,32 @@ METH_IMPL(pup_fixnum_op_lessthan)
 {
 	pup_arity_check(env, 1, argc);
 	struct PupObject *rhs = argv[0];
-	if (target->type != rhs->type) {
-		return pup_env_get_falseinstance(env);
+	if (!pup_object_instanceof(env, rhs, target->type)) {
+		return PUP_FALSE;
 	}
 	struct PupFixnum *left = (struct PupFixnum *)target;
 	struct PupFixnum *right = (struct PupFixnum *)rhs;
-	return left->value < right->value  ? pup_env_get_trueinstance(env)
-	                                    : pup_env_get_falseinstance(env);
+	return PUP_BOOL(left->value < right->value);
 
 }
 
+const struct PupBuiltinMethod pup_fixnum_methods[] = {
+	{ PUP_SYM_OP_PLUS, pup_fixnum_plus },
+	{ PUP_SYM_OP_EQUALS, pup_fixnum_op_equals },
+	{ PUP_SYM_OP_LESSTHAN, pup_fixnum_op_lessthan }
+};
+
 struct PupClass *pup_bootstrap_create_classfixnum(ENV)
 {
 	struct PupClass *class_fix = pup_internal_create_class(env,
 	                                 pup_env_get_classobject(env), // TODO: should be Numeric
 	                                 NULL,  // no lexical scope
 	                                 "Fixnum",
-	                                 &fixnum_allocate_instance,
-	                                 &fixnum_destroy_instance);
-	pup_define_method(class_fix,
-	                  pup_env_str_to_sym(env, "+"),
-	                  pup_fixnum_plus);
-	pup_define_method(class_fix,
-	                  pup_env_str_to_sym(env, "=="),
-	                  pup_fixnum_op_equals);
-	pup_define_method(class_fix,
-	                  pup_env_str_to_sym(env, "<"),
-	                  pup_fixnum_op_lessthan);
+	                                 &pup_fixnum_allocate_instance,
+	                                 &pup_fixnum_destroy_instance,
+	                                 &pup_fixnum_gc_copy_instance);
+	pup_class_set_builtin_methods(class_fix, pup_fixnum_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_fixnum_methods));
 	return class_fix;
 }
 
@@ -1 +1,3 @@
 struct PupClass *pup_bootstrap_create_classfixnum(ENV);
+
+struct PupObject *pup_fixnum_create(ENV, int value);
@@ -1,107 +1,213 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <libunwind.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <atomic_ops.h>
 #include <valgrind/drd.h>
 #include "abortf.h"
 #include "heap.h"
 #include "gc/refqueue.h"
+#include "gc/eventlog.h"
 #include "object.h"
 
+// per-thread state of each thread taking part in sweeping, so that they
+// don't contend on shared counters or copy into the same region
+struct PupGCWorker {
+	// counters marking the progress of a collection,
+	int garbage_count;
+	int live_count;
+	size_t bytes_copied;
+	// region we are currently copying live objects into,
+	struct PupHeapRegion *copy_target;
+	struct PupGCWorker *next;
+};
+
 struct PupGCState {
+	// the heap being collected (NULL when only used for stack scanning),
+	struct PupHeap *heap;
 	// the return value of dlopen(NULL, RTLD_LAZY),
 	void *dlhandle;
 	// actually a 'struct PupRefQueueSegment *' (TODO: atomic access actually needed?)
 	volatile AO_t reference_queue_head;
 	// current bit-value used to mark live objects,
 	volatile AO_t live_mark_value;
-	// counters marking the progress of a collection,
+	// totals of the workers' counters for the last collection,
 	int garbage_count;
 	int live_count;
-	// region we are currently copying live objects into,
-	struct PupHeapRegion *copy_target;
+	size_t bytes_copied;
+	// the calling thread's 'struct PupGCWorker *',
+	pthread_key_t worker_key;
+	// all workers, protected by workers_lock
+	pthread_mutex_t workers_lock;
+	struct PupGCWorker *workers;
 	// the segment we are 
 	struct PupRefQueueSegment *current_segment;
+	// the GC maps of all pup functions, sorted by address,
+	struct PupGCMapRange *map_ranges;
+	int map_range_count;
+	// walk stacks with libunwind rather than following frame pointers,
+	bool unwind_stack;
 };
 
+// fixed-size record, so that a function's safepoints can be binary-searched
 struct PupGCSafepoint {
 	void *safepoint_addr;
-	int frame_size;
-	int live_count;
-	int live_offsets[0];
+	int32_t live_count;
+	// index of this safepoint's first entry in the map's live-offsets table
+	int32_t live_index;
 };
 
+// Layout emitted by MyGCPrinter::finishAssembly(); points[] is sorted by
+// safepoint_addr and is followed directly by the live-offsets side table,
+// int32_t live_offsets[], shared by all the safepoints.
 struct PupGCMap {
 	int32_t point_count;
+	int32_t frame_size;
 	struct PupGCSafepoint points[0];
 };
 
-static const struct PupGCMap *get_stack_frame_roots(struct PupGCState *state,
-                                  unw_cursor_t *cursor)
+// __gcmap_index, emitted once per module, listing every __gcmap_<FUNCTION>
+struct PupGCMapIndex {
+	int32_t map_count;
+	const struct PupGCMap *maps[0];
+};
+
+// the span of safepoint addresses covered by one function's GC map
+struct PupGCMapRange {
+	const void *first_addr;
+	const void *last_addr;
+	const struct PupGCMap *map;
+};
+
+static const int32_t *live_offsets(const struct PupGCMap *gc_map)
 {
-	char proc_name[1024];
-	unw_word_t off;
-	if (unw_get_proc_name(cursor, proc_name, 1024, &off)) {
-		return NULL;
-	}
-	char sym_name[1024];
-	int count = snprintf(sym_name, 1024, "__gcmap_%s", proc_name);
-	if (count >= 1024) {
-		// name longer than buffer,
-		return NULL;
+	return (const int32_t *)&gc_map->points[gc_map->point_count];
+}
+
+static const struct PupGCSafepoint *find_safepoint(
+	const struct PupGCMap *gc_map,
+	const void *ip)
+{
+	int low = 0;
+	int high = gc_map->point_count - 1;
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		const struct PupGCSafepoint *point = &gc_map->points[mid];
+		if (point->safepoint_addr < ip) {
+			low = mid + 1;
+		} else if (point->safepoint_addr > ip) {
+			high = mid - 1;
+		} else {
+			return point;
+		}
 	}
-	dlerror();  // clear any existing error
-	void const *sym = dlsym(state->dlhandle, sym_name);
-	char *err = dlerror();
-	if (err != NULL) {
-		return NULL;
+	return NULL;
+}
+
+static int compare_map_ranges(const void *a, const void *b)
+{
+	const struct PupGCMapRange *ra = a;
+	const struct PupGCMapRange *rb = b;
+	if (ra->first_addr < rb->first_addr) {
+		return -1;
 	}
-	return sym;
+	return ra->first_addr > rb->first_addr;
 }
 
-static const struct PupGCSafepoint *find_safepoint(
-	unw_cursor_t *cursor,
-	const struct PupGCMap *gc_map)
+/*
+ * Builds the sorted table used to map a return address to the GC map of the
+ * pup function containing it.  Programs with no pup code (e.g. the ctests)
+ * have no __gcmap_index, and get an empty table.
+ */
+static int build_map_index(struct PupGCState *state)
 {
-	char proc_name[1024];
-	unw_word_t off;
-	if (unw_get_proc_name(cursor, proc_name, 1024, &off)) {
-		return NULL;
+	state->map_ranges = NULL;
+	state->map_range_count = 0;
+	dlerror();  // clear any existing error
+	const struct PupGCMapIndex *index
+		= dlsym(state->dlhandle, "__gcmap_index");
+	if (dlerror() != NULL || !index || !index->map_count) {
+		return 0;
 	}
-	unw_proc_info_t pip;
-	if (unw_get_proc_info(cursor, &pip)) {
-		return NULL;
+	state->map_ranges
+		= malloc(sizeof(struct PupGCMapRange) * index->map_count);
+	if (!state->map_ranges) {
+		return -1;
 	}
-	if (!pip.start_ip) {
-		// presumably no unwind info available for this stack frame
-		return NULL;
+	for (int i=0; i<index->map_count; i++) {
+		const struct PupGCMap *map = index->maps[i];
+		if (!map->point_count) {
+			continue;
+		}
+		struct PupGCMapRange *range
+			= &state->map_ranges[state->map_range_count++];
+		range->first_addr = map->points[0].safepoint_addr;
+		range->last_addr = map->points[map->point_count-1].safepoint_addr;
+		range->map = map;
 	}
-	void *ip = (void *)(pip.start_ip + off);
-	void const *addr = &gc_map->points[0];
-	for (int i=0; i<gc_map->point_count; i++) {
-		const struct PupGCSafepoint *point = addr;
-		void *safepoint_addr = point->safepoint_addr;
-		if (safepoint_addr == ip) {
-			return point;
+	qsort(state->map_ranges, state->map_range_count,
+	      sizeof(struct PupGCMapRange), compare_map_ranges);
+	return 0;
+}
+
+/*
+ * Returns the GC map of the pup function whose safepoints span the given
+ * address, or NULL if there is none.
+ */
+static const struct PupGCMap *find_gc_map(const struct PupGCState *state,
+                                          const void *ip)
+{
+	int low = 0;
+	int high = state->map_range_count - 1;
+	while (low <= high) {
+		int mid = low + (high - low) / 2;
+		const struct PupGCMapRange *range = &state->map_ranges[mid];
+		if (range->last_addr < ip) {
+			low = mid + 1;
+		} else if (range->first_addr > ip) {
+			high = mid - 1;
+		} else {
+			return range->map;
 		}
-		// skip the live-roots list for this non-matching safepoint,
-		int live_count = point->live_count;
-		addr += sizeof(struct PupGCSafepoint);
-		addr += sizeof(int32_t) * live_count;
-		addr += 4;  // FIXME: alignment hack
 	}
-	ABORTF("no safepoint in %s() for ip=%p", proc_name, ip);
+	return NULL;
 }
 
+/*
+ * Returns the safepoint for the given return address, or NULL if the address
+ * is not within a pup function.
+ */
+static const struct PupGCSafepoint *lookup_safepoint(
+	const struct PupGCState *state,
+	const void *ip,
+	const struct PupGCMap **gc_map)
+{
+	const struct PupGCMap *map = find_gc_map(state, ip);
+	if (!map) {
+		return NULL;
+	}
+	const struct PupGCSafepoint *point = find_safepoint(map, ip);
+	ABORTF_ON(!point, "no safepoint in GC map %p for ip=%p", map, ip);
+	*gc_map = map;
+	return point;
+}
+
+/*
+ * pup code is compiled with frame pointers, and the stack offsets in its GC
+ * maps are therefore relative to the frame pointer rather than to the stack
+ * pointer.
+ */
 static unw_word_t get_frame_pointer(unw_cursor_t *cursor)
 {
-	unw_word_t sp;
-	int res = unw_get_reg(cursor, UNW_X86_64_RSP, &sp);
+	unw_word_t fp;
+	int res = unw_get_reg(cursor, UNW_X86_64_RBP, &fp);
 	if (res) {
 		return 0;
 	}
-	return sp;
+	return fp;
 }
 
 static struct PupRefQueueSegment *get_ref_queue_head(struct PupGCState *state)
@@ -173,18 +279,21 @@ void pup_gc_queue_for_marking(struct PupGCState *state, void **ref)
 }
 
 static void collect_stack_root_pointers(struct PupGCState *state,
-                                        unw_cursor_t *cursor,
+                                        void *fp,
+                                        const struct PupGCMap *gc_map,
                                         const struct PupGCSafepoint *safepoint)
 {
 	struct PupRefQueueSegment *current_segment = NULL;
 
-	unw_word_t fp = get_frame_pointer(cursor);
 	if (!fp) {
 		return;
 	}
+	PUP_GC_EVENT(2, PUP_GC_EV_STACK_FRAME,
+	             safepoint->safepoint_addr, safepoint->live_count);
+	const int32_t *offsets = live_offsets(gc_map) + safepoint->live_index;
 	for (int i=0; i<safepoint->live_count; i++) {
-		int fp_offset = safepoint->live_offsets[i];
-		void **root = ((void *)fp) + fp_offset;
+		int fp_offset = offsets[i];
+		void **root = fp + fp_offset;
 		queue_for_marking(state, root, &current_segment);
 	}
 	if (current_segment) {
@@ -192,22 +301,68 @@ static void collect_stack_root_pointers(struct PupGCState *state,
 	}
 }
 
+void pup_gc_scan_roots(struct PupGCState *state, void ***roots, int count)
+{
+	struct PupRefQueueSegment *current_segment = NULL;
+	for (int i=0; i<count; i++) {
+		if (*roots[i]) {
+			queue_for_marking(state, roots[i], &current_segment);
+		}
+	}
+	if (current_segment) {
+		add_segment_to_global_queue(state, current_segment);
+	}
+}
+
+struct RootObjectScan {
+	struct PupGCState *state;
+	struct PupRefQueueSegment *current_segment;
+};
+
+static void root_object_ref_visitor(struct PupObject **ref, void *data)
+{
+	struct RootObjectScan *scan = data;
+	if (*ref) {
+		queue_for_marking(scan->state, (void **)ref,
+		                  &scan->current_segment);
+	}
+}
+
+void pup_gc_scan_root_objects(struct PupGCState *state, void **objs, int count)
+{
+	struct RootObjectScan scan = {
+		.state = state,
+		.current_segment = NULL
+	};
+	for (int i=0; i<count; i++) {
+		pup_object_each_ref(objs[i], root_object_ref_visitor, &scan);
+	}
+	if (scan.current_segment) {
+		add_segment_to_global_queue(state, scan.current_segment);
+	}
+}
+
 static void scan_stack_frame(struct PupGCState *state, unw_cursor_t *cursor)
 {
-	const struct PupGCMap *gc_map = get_stack_frame_roots(state, cursor);
-	if (!gc_map) {
+	unw_word_t ip;
+	if (unw_get_reg(cursor, UNW_REG_IP, &ip)) {
 		return;
 	}
-	fprintf(stderr, "    %d safe points\n", gc_map->point_count);
-	const struct PupGCSafepoint *safepoint = find_safepoint(cursor, gc_map);
+	const struct PupGCMap *gc_map;
+	const struct PupGCSafepoint *safepoint
+		= lookup_safepoint(state, (void *)ip, &gc_map);
 	if (!safepoint) {
 		return;
 	}
-	collect_stack_root_pointers(state, cursor, safepoint);
-	return;
+	collect_stack_root_pointers(state, (void *)get_frame_pointer(cursor),
+	                            gc_map, safepoint);
 }
 
-void pup_gc_scan_stack(struct PupGCState *state)
+/*
+ * Scan the stack frames older than 'scanned_to' (or all frames, if NULL)
+ * using libunwind's DWARF-driven unwinding.
+ */
+static void scan_stack_unwind(struct PupGCState *state, void *scanned_to)
 {
 	unw_context_t context;
 	unw_cursor_t cursor;
@@ -217,57 +372,300 @@ void pup_gc_scan_stack(struct PupGCState *state)
 	if (unw_init_local(&cursor, &context)) {
 		return;
 	}
-	fprintf(stderr, "doing pup_gc_scan_stack()\n");
 	do {
+		unw_word_t sp;
+		if (scanned_to
+		    && !unw_get_reg(&cursor, UNW_X86_64_RSP, &sp)
+		    && (void *)sp <= scanned_to)
+		{
+			continue;
+		}
 		scan_stack_frame(state, &cursor);
 	} while (unw_step(&cursor) > 0);
 }
 
+static pthread_once_t stack_top_key_once = PTHREAD_ONCE_INIT;
+// the calling thread's stack top (i.e. the highest address),
+static pthread_key_t stack_top_key;
+
+static void create_stack_top_key(void)
+{
+	int res = pthread_key_create(&stack_top_key, NULL /* no dtor */);
+	ABORTF_ON(res, "pthread_key_create() failed with %d", res);
+}
+
+/*
+ * The end of the calling thread's stack, looked up on its first walk and
+ * cached after that.  NULL if it can't be found, in which case there's
+ * nothing to check a frame pointer against.
+ */
+static void *get_stack_top(void)
+{
+	pthread_once(&stack_top_key_once, create_stack_top_key);
+	void *top = pthread_getspecific(stack_top_key);
+	if (top) {
+		return top;
+	}
+	pthread_attr_t attr;
+	if (pthread_getattr_np(pthread_self(), &attr)) {
+		return NULL;
+	}
+	void *addr;
+	size_t size;
+	int res = pthread_attr_getstack(&attr, &addr, &size);
+	pthread_attr_destroy(&attr);
+	if (res) {
+		return NULL;
+	}
+	top = addr + size;
+	pthread_setspecific(stack_top_key, top);
+	return top;
+}
+
+static bool is_plausible_caller_frame(void *stack_top,
+                                      void **fp,
+                                      void **caller_fp)
+{
+	// stacks grow down, so the caller's frame must be at a higher address,
+	// and its saved frame pointer and return address must be on our stack
+	return caller_fp > fp
+	    && (void *)(caller_fp + 2) <= stack_top
+	    && ((uintptr_t)caller_fp & (sizeof(void *) - 1)) == 0;
+}
+
+/*
+ * Walks the chain of saved frame pointers, looking up each return address
+ * in the index of pup GC maps.  The chain ends with the null frame pointer
+ * set up by the C runtime for the initial frame of each thread.  If we meet
+ * a frame compiled without frame pointers (i.e. foreign code) the chain
+ * stops making sense, and libunwind takes over for the rest of the stack.
+ * We take it that this has happened when the next frame pointer leaves the
+ * thread's stack, or when a return address falls inside a pup function but
+ * isn't one of its safepoints.
+ *
+ * The walk starts from this function's own frame, so it must never be
+ * inlined; were it inlined into a pup function (as an LTO build could do,
+ * via pup_env_safepoint()), that function's own roots would be skipped.
+ */
+__attribute__((noinline))
+static void scan_stack(struct PupGCState *state)
+{
+	void *stack_top = get_stack_top();
+	if (state->unwind_stack || !stack_top) {
+		scan_stack_unwind(state, NULL);
+		return;
+	}
+	void **fp = __builtin_frame_address(0);
+	while (fp) {
+		void **caller_fp = fp[0];
+		const void *return_addr = fp[1];
+		if (caller_fp
+		    && !is_plausible_caller_frame(stack_top, fp, caller_fp)) {
+			scan_stack_unwind(state, fp);
+			return;
+		}
+		const struct PupGCMap *gc_map = find_gc_map(state, return_addr);
+		if (gc_map) {
+			const struct PupGCSafepoint *safepoint
+				= find_safepoint(gc_map, return_addr);
+			if (!safepoint) {
+				scan_stack_unwind(state, fp);
+				return;
+			}
+			collect_stack_root_pointers(state, caller_fp,
+			                            gc_map, safepoint);
+		}
+		fp = caller_fp;
+	}
+}
+
+// as scan_stack_unwind(), for pup_gc_backtrace()
+static int backtrace_unwind(const struct PupGCState *state,
+                            void **addrs,
+                            int max)
+{
+	unw_context_t context;
+	unw_cursor_t cursor;
+	if (unw_getcontext(&context)) {
+		return 0;
+	}
+	if (unw_init_local(&cursor, &context)) {
+		return 0;
+	}
+	int count = 0;
+	do {
+		unw_word_t ip;
+		const struct PupGCMap *gc_map;
+		if (!unw_get_reg(&cursor, UNW_REG_IP, &ip)
+		    && lookup_safepoint(state, (void *)ip, &gc_map))
+		{
+			addrs[count++] = (void *)ip;
+		}
+	} while (count < max && unw_step(&cursor) > 0);
+	return count;
+}
+
+// (noinline for the same reason as scan_stack())
+__attribute__((noinline))
+int pup_gc_backtrace(const struct PupGCState *state, void **addrs, int max)
+{
+	void *stack_top = get_stack_top();
+	if (state->unwind_stack || !stack_top) {
+		return backtrace_unwind(state, addrs, max);
+	}
+	// the same walk as scan_stack(), except that it just stops at any
+	// foreign frame; the frames of interest are nearer than that
+	int count = 0;
+	void **fp = __builtin_frame_address(0);
+	while (fp && count < max) {
+		void **caller_fp = fp[0];
+		const void *return_addr = fp[1];
+		if (caller_fp
+		    && !is_plausible_caller_frame(stack_top, fp, caller_fp)) {
+			break;
+		}
+		const struct PupGCMap *gc_map = find_gc_map(state, return_addr);
+		if (gc_map) {
+			if (!find_safepoint(gc_map, return_addr)) {
+				// the chain went astray somewhere nearer, so
+				// start again with libunwind
+				return backtrace_unwind(state, addrs, max);
+			}
+			addrs[count++] = (void *)return_addr;
+		}
+		fp = caller_fp;
+	}
+	return count;
+}
+
+void pup_gc_scan_stack(struct PupGCState *state)
+{
+	PUP_GC_EVENT(2, PUP_GC_EV_STACK_SCAN_START, 0, 0);
+	scan_stack(state);
+	PUP_GC_EVENT(2, PUP_GC_EV_STACK_SCAN_END, 0, 0);
+}
+
 static void set_live_mark_value(struct PupGCState *state, int mark)
 {
 	AO_store(&state->live_mark_value, mark);
 	ANNOTATE_HAPPENS_BEFORE(&state->live_mark_value);
 }
 
-struct PupGCState *pup_gc_state_create(void)
+struct PupGCState *pup_gc_state_create(struct PupHeap *heap)
 {
 	struct PupGCState *state = malloc(sizeof(struct PupGCState));
 	if (!state) return NULL;
+	state->heap = heap;
 	state->dlhandle = dlopen(NULL, RTLD_LAZY);
 	if (!state->dlhandle) {
 		free(state);
 		return NULL;
 	}
+	if (build_map_index(state)) {
+		dlclose(state->dlhandle);
+		free(state);
+		return NULL;
+	}
+	if (pthread_key_create(&state->worker_key, NULL /* no dtor */)) {
+		dlclose(state->dlhandle);
+		free(state->map_ranges);
+		free(state);
+		return NULL;
+	}
+	pthread_mutex_init(&state->workers_lock, NULL);
+	state->workers = NULL;
+	state->current_segment = NULL;
+	state->unwind_stack = getenv("PUP_GC_UNWIND_STACK") != NULL;
 	set_ref_queue_head(state, NULL);
 	set_live_mark_value(state, 0);
-	// these are initialised in pup_gc_period_start()
-	//state->garbage_count = 0;
-	//state->live_count = 0;
-	state->copy_target = NULL;
+	state->garbage_count = 0;
+	state->live_count = 0;
+	state->bytes_copied = 0;
 	return state;
 }
 
 void pup_gc_state_destroy(struct PupGCState *state)
 {
+	struct PupGCWorker *worker = state->workers;
+	while (worker) {
+		struct PupGCWorker *tmp = worker;
+		worker = worker->next;
+		free(tmp);
+	}
+	pthread_mutex_destroy(&state->workers_lock);
+	pthread_key_delete(state->worker_key);
 	dlclose(state->dlhandle);
+	free(state->map_ranges);
 	free(state);
 }
 
+/*
+ * The calling thread's worker record, created the first time the thread
+ * does some collection work.
+ */
+static struct PupGCWorker *get_worker(struct PupGCState *state)
+{
+	struct PupGCWorker *worker = pthread_getspecific(state->worker_key);
+	if (worker) {
+		return worker;
+	}
+	worker = calloc(1, sizeof(struct PupGCWorker));
+	ABORT_ON(!worker, "calloc() failed");
+	int res = pthread_setspecific(state->worker_key, worker);
+	ABORTF_ON(res, "pthread_setspecific() failed with %d", res);
+	pthread_mutex_lock(&state->workers_lock);
+	worker->next = state->workers;
+	state->workers = worker;
+	pthread_mutex_unlock(&state->workers_lock);
+	return worker;
+}
+
 
 void pup_gc_scan_heap(struct PupGCState *state)
 {
 	int count = 0;
-	struct PupRefQueueSegment *seg;
-	while ((seg = steal_segment_from_global_queue(state)) != NULL) {
+	while (true) {
+		struct PupRefQueueSegment *seg
+			= steal_segment_from_global_queue(state);
+		if (!seg) {
+			// references found while scanning may still be waiting
+			// in a partly-filled segment,
+			seg = state->current_segment;
+			state->current_segment = NULL;
+			if (!seg) {
+				break;
+			}
+		}
 		count++;
 		pup_refqueuesegment_scan(seg, state);
+		pup_refqueuesegment_destroy(seg);
+	}
+	PUP_GC_EVENT(1, PUP_GC_EV_HEAP_SCAN, count, 0);
+}
+
+void pup_gc_satb_log(struct PupGCState *state,
+                     struct PupRefQueueSegment **buffer,
+                     struct PupObject *old_value)
+{
+	queue_for_marking(state, (void **)&old_value, buffer);
+}
+
+void pup_gc_satb_flush(struct PupGCState *state,
+                       struct PupRefQueueSegment **buffer)
+{
+	if (*buffer) {
+		add_segment_to_global_queue(state, *buffer);
+		*buffer = NULL;
 	}
-	fprintf(stderr, "pup_gc_scan_heap() processed %d segments\n", count);
 }
 
 bool pup_gc_mark_reachable(struct PupGCState *state, struct PupObject *ref)
 {
-	return pup_object_gc_mark(ref, state->live_mark_value);
+	if (!pup_heap_contains(state->heap, ref)) {
+		// not something we manage, so nothing to trace,
+		return false;
+	}
+	return pup_heap_mark(state->heap, ref, state->live_mark_value);
 }
 
 int pup_gc_get_current_mark(const struct PupGCState *state)
@@ -277,33 +675,67 @@ int pup_gc_get_current_mark(const struct PupGCState *state)
 	return AO_load(&state->live_mark_value);
 }
 
-bool pup_gc_is_live_mark(const struct PupGCState *state, const int mark_value)
+void pup_gc_add_garbage_count(struct PupGCState *state, int count)
 {
-	return pup_gc_get_current_mark(state) == mark_value;
+	get_worker(state)->garbage_count += count;
 }
 
-void pup_gc_inc_garbage_count(struct PupGCState *state)
+void pup_gc_inc_live_count(struct PupGCState *state)
 {
-	state->garbage_count++;
+	get_worker(state)->live_count++;
 }
 
-void pup_gc_inc_live_count(struct PupGCState *state)
+void pup_gc_period_start(struct PupGCState *state)
 {
-	state->live_count++;
+	pthread_mutex_lock(&state->workers_lock);
+	for (struct PupGCWorker *w=state->workers; w; w=w->next) {
+		w->garbage_count = 0;
+		w->live_count = 0;
+		w->bytes_copied = 0;
+	}
+	pthread_mutex_unlock(&state->workers_lock);
+	int mark = !state->live_mark_value;
+	// the bitmap for the new mark value still holds the marks from the
+	// collection before last,
+	pup_heap_clear_marks(state->heap, mark);
+	set_live_mark_value(state, mark);
+	PUP_GC_EVENT(1, PUP_GC_EV_GC_START, mark, 0);
 }
 
-void pup_gc_period_start(struct PupGCState *state)
+void pup_gc_period_end(struct PupGCState *state)
 {
 	state->garbage_count = 0;
 	state->live_count = 0;
-	set_live_mark_value(state, !state->live_mark_value);
+	state->bytes_copied = 0;
+	pthread_mutex_lock(&state->workers_lock);
+	for (struct PupGCWorker *w=state->workers; w; w=w->next) {
+		state->garbage_count += w->garbage_count;
+		state->live_count += w->live_count;
+		state->bytes_copied += w->bytes_copied;
+		// the copies are now ordinary live objects,
+		if (w->copy_target) {
+			pup_heap_add_to_global_heap(state->heap, w->copy_target);
+			w->copy_target = NULL;
+		}
+	}
+	pthread_mutex_unlock(&state->workers_lock);
+	PUP_GC_EVENT(1, PUP_GC_EV_GC_END,
+	             state->live_count, state->garbage_count);
 }
 
-void pup_gc_period_end(struct PupGCState *state)
+int pup_gc_get_live_count(const struct PupGCState *state)
+{
+	return state->live_count;
+}
+
+int pup_gc_get_garbage_count(const struct PupGCState *state)
 {
-	fprintf(stderr, "live:%d garbage:%d\n",
-	                state->live_count,
-	                state->garbage_count);
+	return state->garbage_count;
+}
+
+size_t pup_gc_get_bytes_copied(const struct PupGCState *state)
+{
+	return state->bytes_copied;
 }
 
 // TODO: deduplicate vs. heap.c thread_local_alloc()
@@ -313,22 +745,25 @@ void *pup_gc_alloc_for_copy(struct PupGCState *state,
                             const size_t size,
                             const enum PupHeapKind kind)
 {
-	struct PupHeapRegion *region = state->copy_target;
-	ABORTF_ON(!region, "region is NULL");
-	if (!pup_heap_region_have_room_for(region, size)) {
+	struct PupGCWorker *worker = get_worker(state);
+	struct PupHeapRegion *region = worker->copy_target;
+	if (!region) {
+		region = pup_heap_region_allocate(heap);
+		ABORTF_ON(!region, "pup_heap_region_allocate() failed");
+		worker->copy_target = region;
+	} else if (!pup_heap_region_have_room_for(region, size)) {
 		// the old region doesn't have the space, so create a new
 		// thread-local region and have the old one added to the global
 		// region list
 		struct PupHeapRegion *old_region = region;
-		region = pup_heap_region_allocate();
+		region = pup_heap_region_allocate(heap);
 		ABORTF_ON(!region, "pup_heap_region_allocate() failed");
-		state->copy_target = region;
+		worker->copy_target = region;
 		pup_heap_add_to_global_heap(heap, old_region);
 	}
 	void *obj = pup_heap_region_make_room_for(region, size, kind);
-	// obj should gain the correct gc_mark when it gets copied
-	// from its current region to *obj, so no
-	// pup_object_gc_mark_unconditionally() call needed here
-	
+	worker->bytes_copied += size;
+	// the copy is left unmarked; marks only describe the objects in the
+	// regions being collected
 	return obj;
 }
@@ -5,22 +5,60 @@
 
 struct PupGCState;
 struct PupObject;
+struct PupRefQueueSegment;
 
 void pup_gc_scan_stack(struct PupGCState *state);
-struct PupGCState *pup_gc_state_create(void);
+
+/**
+ * Records the return addresses of (up to 'max' of) the pup frames on the
+ * calling thread's stack, innermost first, walking the stack as for root
+ * scanning.  Returns the number recorded.
+ */
+int pup_gc_backtrace(const struct PupGCState *state, void **addrs, int max);
+
+/**
+ * Queues the objects referenced from the given root locations (outside of
+ * any stack) for marking.
+ */
+void pup_gc_scan_roots(struct PupGCState *state, void ***roots, int count);
+
+/**
+ * Queues the objects referenced by the given objects, which live outside
+ * the heap and so are never marked themselves, for marking.
+ */
+void pup_gc_scan_root_objects(struct PupGCState *state, void **objs, int count);
+struct PupGCState *pup_gc_state_create(struct PupHeap *heap);
 void pup_gc_state_destroy(struct PupGCState *state);
 void pup_gc_scan_heap(struct PupGCState *state);
 bool pup_gc_mark_reachable(struct PupGCState *state, struct PupObject *ref);
 int pup_gc_get_current_mark(const struct PupGCState *state);
-bool pup_gc_is_live_mark(const struct PupGCState *state, const int mark_value);
-void pup_gc_inc_garbage_count(struct PupGCState *state);
+void pup_gc_add_garbage_count(struct PupGCState *state, int count);
 void pup_gc_inc_live_count(struct PupGCState *state);
 void pup_gc_period_start(struct PupGCState *state);
 void pup_gc_period_end(struct PupGCState *state);
+
+/**
+ * Totals for the collection most recently ended by pup_gc_period_end().
+ */
+int pup_gc_get_live_count(const struct PupGCState *state);
+int pup_gc_get_garbage_count(const struct PupGCState *state);
+size_t pup_gc_get_bytes_copied(const struct PupGCState *state);
 void *pup_gc_alloc_for_copy(struct PupGCState *state,
                             struct PupHeap *heap,
                             size_t size,
                             enum PupHeapKind kind);
 void pup_gc_queue_for_marking(struct PupGCState *state, void **ref);
 
+/**
+ * Snapshot-at-the-beginning logging: records a reference about to be
+ * overwritten while marking is in progress, in a buffer private to the
+ * calling mutator thread.  pup_gc_satb_flush() hands the buffer over to
+ * the collector.
+ */
+void pup_gc_satb_log(struct PupGCState *state,
+                     struct PupRefQueueSegment **buffer,
+                     struct PupObject *old_value);
+void pup_gc_satb_flush(struct PupGCState *state,
+                       struct PupRefQueueSegment **buffer);
+
 #endif  // _GC_H
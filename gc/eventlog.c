@@ -0,0 +1,150 @@
+#include "eventlog.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic_ops.h>
+#include <valgrind/drd.h>
+#include "../abortf.h"
+
+// events kept per thread; older events are overwritten
+#define RING_SIZE 4096
+
+struct EventRing {
+	// count of events ever recorded; only the owning thread writes it,
+	volatile AO_t recorded;
+	uint32_t thread;
+	// actually a 'struct EventRing *',
+	AO_t next;
+	struct PupGCEvent events[RING_SIZE];
+};
+
+int pup_gc_eventlog_level = 0;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+// actually a 'struct EventRing *', the list of all threads' rings,
+static volatile AO_t ring_list = 0;
+static volatile AO_t ring_count = 0;
+
+static const char *event_names[PUP_GC_EV_TYPE_COUNT] = {
+	"gc-start",
+	"gc-end",
+	"roots-start",
+	"roots-end",
+	"remark-start",
+	"remark-end",
+	"heap-scan",
+	"sweep-start",
+	"sweep-end",
+	"safepoint-request",
+	"stack-scan-start",
+	"stack-frame",
+	"stack-scan-end",
+	"ref",
+	"attr"
+};
+
+const char *pup_gc_event_name(uint32_t type)
+{
+	if (type >= PUP_GC_EV_TYPE_COUNT) {
+		return "unknown";
+	}
+	return event_names[type];
+}
+
+static void create_key(void)
+{
+	int res = pthread_key_create(&ring_key, NULL /* no dtor */);
+	ABORTF_ON(res, "pthread_key_create() failed with %d", res);
+}
+
+void pup_gc_eventlog_init(void)
+{
+	const char *level = getenv("PUP_GC_LOG");
+	pup_gc_eventlog_level = level ? atoi(level) : 0;
+	pthread_once(&key_once, create_key);
+}
+
+static void attach_ring(struct EventRing *ring)
+{
+	while (true) {
+		AO_t head = AO_load(&ring_list);
+		AO_store(&ring->next, head);
+		if (AO_compare_and_swap(&ring_list, head, (AO_t)ring)) {
+			ANNOTATE_HAPPENS_BEFORE(&ring_list);
+			return;
+		}
+	}
+}
+
+static struct EventRing *get_ring(void)
+{
+	struct EventRing *ring = pthread_getspecific(ring_key);
+	if (ring) {
+		return ring;
+	}
+	ring = calloc(1, sizeof(struct EventRing));
+	ABORT_ON(!ring, "calloc() failed");
+	ring->thread = AO_fetch_and_add1(&ring_count);
+	pthread_setspecific(ring_key, ring);
+	attach_ring(ring);
+	return ring;
+}
+
+void pup_gc_eventlog_record(enum PupGCEventType type, uint64_t a, uint64_t b)
+{
+	struct EventRing *ring = get_ring();
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	AO_t n = AO_load(&ring->recorded);
+	struct PupGCEvent *ev = &ring->events[n % RING_SIZE];
+	ev->time_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	ev->thread = ring->thread;
+	ev->type = type;
+	ev->a = a;
+	ev->b = b;
+	// publish the event only once it is complete,
+	AO_store(&ring->recorded, n + 1);
+	ANNOTATE_HAPPENS_BEFORE(&ring->recorded);
+}
+
+/*
+ * Writes every thread's buffered events to PUP_GC_LOG_FILE.  Events are
+ * written ring by ring; tools/gclog_dump sorts them by time.
+ */
+int pup_gc_eventlog_dump(void)
+{
+	if (!pup_gc_eventlog_level) {
+		return 0;
+	}
+	const char *filename = getenv("PUP_GC_LOG_FILE");
+	FILE *out = fopen(filename ? filename : "pup-gc.log", "wb");
+	if (!out) {
+		return -1;
+	}
+	struct PupGCLogHeader header;
+	memcpy(header.magic, PUP_GC_LOG_MAGIC, sizeof(header.magic));
+	header.event_size = sizeof(struct PupGCEvent);
+	header.event_count = 0;
+	fwrite(&header, sizeof(header), 1, out);
+	for (struct EventRing *ring = (struct EventRing *)AO_load(&ring_list);
+	     ring;
+	     ring = (struct EventRing *)AO_load(&ring->next))
+	{
+		ANNOTATE_HAPPENS_AFTER(&ring->recorded);
+		AO_t recorded = AO_load(&ring->recorded);
+		uint32_t count = recorded < RING_SIZE ? recorded : RING_SIZE;
+		for (AO_t i = recorded - count; i < recorded; i++) {
+			fwrite(&ring->events[i % RING_SIZE],
+			       sizeof(struct PupGCEvent), 1, out);
+		}
+		header.event_count += count;
+	}
+	// now that we know how many events were written,
+	rewind(out);
+	fwrite(&header, sizeof(header), 1, out);
+	return fclose(out) ? -1 : 0;
+}
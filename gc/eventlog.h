@@ -0,0 +1,71 @@
+#ifndef _GC_EVENTLOG_H
+#define _GC_EVENTLOG_H
+
+#include <stdint.h>
+
+/*
+ * Binary log of GC activity, recorded into a ring buffer per thread, and
+ * written to a file by pup_gc_eventlog_dump() for offline decoding with
+ * tools/gclog_dump.
+ *
+ * PUP_GC_LOG sets the verbosity (default 0, i.e. nothing recorded),
+ *   1 - collection phases and totals
+ *   2 - also per-thread safepoints and per-frame stack scanning
+ *   3 - also every reference traced
+ * PUP_GC_LOG_FILE names the dump file (default "pup-gc.log").
+ */
+
+enum PupGCEventType {
+	PUP_GC_EV_GC_START,       // a: new mark value
+	PUP_GC_EV_GC_END,         // a: live objects, b: garbage objects
+	PUP_GC_EV_ROOTS_START,
+	PUP_GC_EV_ROOTS_END,
+	PUP_GC_EV_REMARK_START,
+	PUP_GC_EV_REMARK_END,
+	PUP_GC_EV_HEAP_SCAN,      // a: ref queue segments processed
+	PUP_GC_EV_SWEEP_START,
+	PUP_GC_EV_SWEEP_END,
+	PUP_GC_EV_SAFEPOINT_REQUEST,  // a: pthread_t of the mutator
+	PUP_GC_EV_STACK_SCAN_START,
+	PUP_GC_EV_STACK_FRAME,    // a: return address, b: live roots
+	PUP_GC_EV_STACK_SCAN_END,
+	PUP_GC_EV_REF,            // a: location of reference, b: referent
+	PUP_GC_EV_ATTR,           // a: attribute list entry
+	PUP_GC_EV_TYPE_COUNT
+};
+
+// on-disk (and in-memory) representation of an event
+struct PupGCEvent {
+	uint64_t time_ns;  // CLOCK_MONOTONIC
+	uint32_t thread;   // order in which the recording thread first logged
+	uint32_t type;     // enum PupGCEventType
+	uint64_t a;
+	uint64_t b;
+};
+
+#define PUP_GC_LOG_MAGIC "PUPGCEV1"
+
+// the dump file starts with this, followed by 'event_count' events
+struct PupGCLogHeader {
+	char magic[8];
+	uint32_t event_size;
+	uint32_t event_count;
+};
+
+// verbosity, from PUP_GC_LOG; checked inline so that disabled events
+// cost no more than a load and compare
+extern int pup_gc_eventlog_level;
+
+#define PUP_GC_EVENT(level, type, a, b) \
+	do { \
+		if (pup_gc_eventlog_level >= (level)) { \
+			pup_gc_eventlog_record((type), (uint64_t)(a), (uint64_t)(b)); \
+		} \
+	} while (0)
+
+void pup_gc_eventlog_init(void);
+void pup_gc_eventlog_record(enum PupGCEventType type, uint64_t a, uint64_t b);
+int pup_gc_eventlog_dump(void);
+const char *pup_gc_event_name(uint32_t type);
+
+#endif  // _GC_EVENTLOG_H
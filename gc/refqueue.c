@@ -4,6 +4,8 @@
 #include <valgrind/drd.h>
 #include "../abortf.h"
 #include "../object.h"
+#include "../heap.h"
+#include "eventlog.h"
 
 #define REF_QUEUE_SEGMENT_SIZE 200
 
@@ -67,12 +69,15 @@ static void ref_visitor(struct PupObject **ref, void *data)
 {
 	struct PupGCState *state = data;
 	pup_gc_queue_for_marking(state, (void **)ref);
-	fprintf(stderr, "	ref_visitor() at %p found %p\n", ref, *ref);
+	PUP_GC_EVENT(3, PUP_GC_EV_REF, ref, *ref);
 }
 
 static void scan_queue_ref(struct PupObject *ref, struct PupGCState *state)
 {
-	if (pup_gc_mark_reachable(state, ref)) {
+	// allocations other than objects (e.g. an object's attribute entries)
+	// are kept alive by the mark, but hold no references to follow
+	if (pup_gc_mark_reachable(state, ref)
+	    && pup_heap_kind_of(ref) == PUP_KIND_OBJ) {
 		pup_object_each_ref(ref, ref_visitor, state);
 	}
 }
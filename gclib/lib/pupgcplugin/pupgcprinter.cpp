@@ -11,6 +11,7 @@
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCStreamer.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
 
 using namespace llvm;
 
@@ -29,6 +30,8 @@ namespace {
       // Put this in the data section.
       AP.OutStreamer.SwitchSection(AP.getObjFileLowering().getDataSection());
       
+      SmallVector<MCSymbol *, 64> MapSyms;
+
       // For each function...
       for (iterator FI = begin(), FE = end(); FI != FE; ++FI) {
         GCFunctionInfo &MD = **FI;
@@ -37,12 +40,20 @@ namespace {
         // 
         // struct {
         //   int32_t PointCount;
+        //   int32_t FrameSize;
         //   struct {
         //     void *SafePointAddress;
         //     int32_t LiveCount;
-        //     int32_t LiveOffsets[LiveCount];
+        //     int32_t LiveIndex;
         //   } Points[PointCount];
+        //   int32_t LiveOffsets[];
         // } __gcmap_<FUNCTIONNAME>;
+        //
+        // Points[] records are fixed-size, and appear in ascending address
+        // order (GCFunctionInfo records safe points while walking the
+        // machine code in layout order), so the runtime can binary-search
+        // them.  Each point's live roots are LiveOffsets[LiveIndex] to
+        // LiveOffsets[LiveIndex+LiveCount-1].
         
         // Align to address width.
         AP.EmitAlignment(AddressAlignLog);
@@ -66,6 +77,7 @@ namespace {
         AP.OutStreamer.AddComment("live roots for " +
                                   Twine(MD.getFunction().getName()));
 	AP.OutStreamer.EmitLabel(Sym);
+	MapSyms.push_back(Sym);
 
         //AP.OutStreamer.AddBlankLine();
 
@@ -74,8 +86,13 @@ namespace {
         // Emit PointCount.
         AP.OutStreamer.AddComment("safe point count");
         AP.EmitInt32(MD.size());
+
+        // Emit the stack frame size.
+        AP.OutStreamer.AddComment("stack frame size");
+        AP.EmitInt32(MD.getFrameSize());
         
         // And each safe point...
+        int LiveIndex = 0;
         for (GCFunctionInfo::iterator PI = MD.begin(),
                                          PE = MD.end(); PI != PE; ++PI) {
           // Align to address width.
@@ -85,15 +102,20 @@ namespace {
           AP.OutStreamer.AddComment("safe point address");
           AP.OutStreamer.EmitSymbolValue(PI->Label, IntPtrSize, 0);
           
-          // Emit the stack frame size.
-          AP.OutStreamer.AddComment("stack frame size");
-          AP.EmitInt32(MD.getFrameSize());
-          
-          // Emit the number of live roots in the function.
+          // Emit the number of live roots at this safe point.
           AP.OutStreamer.AddComment("live root count");
           AP.EmitInt32(MD.live_size(PI));
-          
-          // And for each live root...
+
+          // Emit where this safe point's roots start in LiveOffsets[].
+          AP.OutStreamer.AddComment("live offsets index");
+          AP.EmitInt32(LiveIndex);
+
+          LiveIndex += MD.live_size(PI);
+        }
+
+        // Then the live roots of every safe point, in the same order...
+        for (GCFunctionInfo::iterator PI = MD.begin(),
+                                         PE = MD.end(); PI != PE; ++PI) {
           for (GCFunctionInfo::live_iterator LI = MD.live_begin(PI),
                                                 LE = MD.live_end(PI);
                                                 LI != LE; ++LI) {
@@ -103,6 +125,27 @@ namespace {
           }
         }
       }
+
+      // Finally, emit an index of all the maps, so that the runtime can
+      // find the map for a given return address without symbol lookups:
+      //
+      // struct {
+      //   int32_t MapCount;
+      //   void *Maps[MapCount];
+      // } __gcmap_index;
+      AP.EmitAlignment(AddressAlignLog);
+      SmallString<128> IndexName;
+      AP.Mang->getNameWithPrefix(IndexName, "__gcmap_index");
+      MCSymbol *IndexSym = AP.OutContext.GetOrCreateSymbol(IndexName);
+      AP.OutStreamer.EmitSymbolAttribute(IndexSym, MCSA_Global);
+      AP.OutStreamer.EmitLabel(IndexSym);
+      AP.OutStreamer.AddComment("map count");
+      AP.EmitInt32(MapSyms.size());
+      AP.EmitAlignment(AddressAlignLog);
+      for (unsigned i = 0, e = MapSyms.size(); i != e; ++i) {
+        AP.OutStreamer.AddComment("map address");
+        AP.OutStreamer.EmitSymbolValue(MapSyms[i], IntPtrSize, 0);
+      }
     }
 //    virtual void beginAssembly(std::ostream &OS, AsmPrinter &AP,
 //                               const MCAsmInfo &MCAI);
@@ -0,0 +1,89 @@
+#include <string.h>
+#include <limits.h>
+#include "env.h"
+#include "object.h"
+#include "raise.h"
+#include "exception.h"
+#include "core_types.h"
+#include "class.h"
+#include "core_syms.h"
+#include "string.h"
+#include "fixnum.h"
+#include "heap.h"
+
+// Fixnum only holds an int, so figures are given in whole units, and
+// clamped
+static struct PupObject *stat_fixnum(ENV, double value)
+{
+	if (value > INT_MAX) {
+		value = INT_MAX;
+	}
+	return pup_fixnum_create(env, (int)value);
+}
+
+// GC.stat("name") gives the named figure, e.g. GC.stat("cycles")
+METH_IMPL(pup_gc_stat)
+{
+	pup_arity_check(env, 1, argc);
+	const char *name = pup_string_value(env, argv[0]);
+	struct PupGCStats stats;
+	pup_env_get_gc_stats(env, &stats);
+	const struct {
+		const char *name;
+		double value;
+	} figures[] = {
+		{ "cycles", stats.cycles },
+		{ "pause_count", stats.pause_count },
+		{ "pause_min_us", stats.pause_min_us },
+		{ "pause_avg_us", stats.pause_avg_us },
+		{ "pause_p99_us", stats.pause_p99_us },
+		{ "pause_max_us", stats.pause_max_us },
+		{ "bytes_allocated", stats.bytes_allocated },
+		{ "bytes_copied", stats.bytes_copied },
+		{ "survival_percent", stats.survival_rate * 100 },
+		{ "regions_in_use", stats.regions_in_use },
+		{ "regions_freed", stats.regions_freed },
+		{ "time_to_safepoint_avg_us", stats.time_to_safepoint_avg_us },
+		{ "time_to_safepoint_max_us", stats.time_to_safepoint_max_us }
+	};
+	for (int i=0; i<sizeof(figures)/sizeof(figures[0]); i++) {
+		if (!strcmp(figures[i].name, name)) {
+			return stat_fixnum(env, figures[i].value);
+		}
+	}
+	pup_raise(pup_new_runtimeerrorf(env, "unknown GC stat '%s'", name));
+	abort();
+}
+
+struct PupObject *pup_gc_allocate_instance(ENV, struct PupClass *type)
+{
+	pup_raise_runtimeerror(env, "you can't call 'new' on GC");
+	abort();
+}
+
+void pup_gc_destroy_instance(struct PupObject *obj)
+{
+	// nothing to do
+}
+
+const struct PupBuiltinMethod pup_gc_methods[] = {
+	{ PUP_SYM_STAT, pup_gc_stat }
+};
+
+struct PupObject *pup_bootstrap_create_gc_object(ENV)
+{
+	struct PupClass *class_gc = pup_internal_create_class(env,
+	                                 pup_env_get_classobject(env),
+	                                 NULL,  // no lexical scope
+	                                 "GC",
+	                                 &pup_gc_allocate_instance,
+	                                 &pup_gc_destroy_instance,
+	                                 &pup_object_gc_copy_instance);
+	pup_class_set_builtin_methods(class_gc, pup_gc_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_gc_methods));
+	// there is only ever this one instance,
+	struct PupObject *gc =
+		(struct PupObject *)pup_alloc_obj(env, sizeof(struct PupObject));
+	obj_init(gc, class_gc);
+	return gc;
+}
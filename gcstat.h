@@ -0,0 +1,5 @@
+/*
+ * Bootstrap the 'GC' object, whose stat() method gives pup programs the
+ * figures from pup_heap_get_gc_stats()
+ */
+struct PupObject *pup_bootstrap_create_gc_object(ENV);
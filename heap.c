@@ -2,6 +2,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -16,19 +18,64 @@
 #include "heap.h"
 #include "object.h"
 #include "gc.h"
+#include "gc/eventlog.h"
 
-#define REGION_SIZE 0x100000
-#define MAX_REGION_ALLOCATION 0x1000
+// regions are (1 << heap->region_shift) bytes, 1MB by default,
+#define DEFAULT_REGION_SHIFT 20
+// with PUP_HEAP_HUGE_PAGES, regions match the 2MB x86-64 huge page size,
+#define HUGE_PAGE_REGION_SHIFT 21
+#define MIN_REGION_SHIFT 16
+// objects bigger than this fraction of a region go in the large object
+// space instead, limiting the space wasted at the end of each region,
+#define LARGE_OBJECT_REGION_FRACTION 8
+#define DEFAULT_REGION_POOL_LIMIT 16
+// default upper bound on the number of threads sweeping regions,
+#define MAX_DEFAULT_SWEEP_THREADS 4
+// default upper bound on the heap's address range, in megabytes,
+#define DEFAULT_HEAP_MAX_MB 128
 
+// each bit of a mark bitmap covers one granule of the heap, and all heap
+// allocations are a whole number of granules,
+#define MARK_GRANULE_SHIFT 3
+#define MARK_GRANULE (1 << MARK_GRANULE_SHIFT)
+#define BITS_PER_WORD (sizeof(AO_t) * 8)
+
+// what a mutator does when it reaches a safepoint on behalf of the gc,
+// held in heap->gc_phase
+enum GCPhase {
+	// snapshot the roots on the thread's stack,
+	GC_PHASE_ROOTS,
+	// hand over the thread's SATB buffer,
+	GC_PHASE_REMARK
+};
+
+// values stored per-region in heap->region_state,
+enum RegionState {
+	REGION_UNCOMMITTED = 0,
+	REGION_IN_USE,
+	REGION_POOLED,
+	// swept and found to hold only garbage, but not yet reset for reuse
+	REGION_RECLAIMABLE,
+	// part of a large object's run of regions, other than the first
+	REGION_LARGE_TAIL
+};
+
+// The descriptor of each region lives at the start of the region's own
+// memory, and objects are allocated from just after it.  For a large
+// object's run of regions, only the first has a descriptor, and 'end'
+// covers the whole run.
 struct PupHeapRegion {
 	void *region;
 	void *end;
 	void *allocated;
 	// actually a 'struct PupHeapRegion *',
 	AO_t next;
-	int read_only;
+	// number of PUP_KIND_OBJ allocations made in this region,
+	int object_count;
 };
 
+#define REGION_HEADER_SIZE ((sizeof(struct PupHeapRegion) + 15) & ~15)
+
 struct PupThreadInfo {
 	AO_t tid;
 	struct PupHeapRegion *local_region;
@@ -38,43 +85,81 @@ struct PupThreadInfo {
 	// are marked volatile,
 	volatile int gc_waiting;
 	volatile int current_gc_mark;
+	// old values of references overwritten while marking is under way,
+	// not yet handed over to the collector
+	struct PupRefQueueSegment *satb_buffer;
+	// allocated since this thread last reached a gc safepoint,
+	size_t bytes_allocated;
 };
 
-// TODO: optimise HeapObject layout
+// A single word (PUP_HEAP_HEADER_SIZE bytes) in front of every allocation.
+// Mark bits are kept in the heap's side bitmaps rather than here.
 struct HeapObject {
-	size_t object_size;  // the requested size (NB not HeapObject's size)
-	unsigned int kind : 1;  // is it an object or an AttrListEntry
+	uint64_t kind : 1;  // is it an object or an AttrListEntry
+	// for the copying collector, to set once the object has been copied
+	// elsewhere and its first word of data holds the address of the copy
+	uint64_t forwarded : 1;
+	// size of the whole allocation, including this header, in granules
+	uint64_t granules : 62;
 	char data[0];  // actual object data starts from here
 };
 
-struct PupHeapRegion *pup_heap_region_allocate(void)
+static void region_init(struct PupHeap *heap, struct PupHeapRegion *region)
 {
-	struct PupHeapRegion *region = malloc(sizeof(struct PupHeapRegion));
-	if (!region) {
-		return NULL;
-	}
 	region->next = 0;
-	// TODO: assert REGION_SIZE is a multiple of page-size
-	region->region = mmap(NULL,
-	                    REGION_SIZE,
-	                    PROT_READ|PROT_WRITE,
-			    MAP_PRIVATE|MAP_ANONYMOUS,
-			    -1,  // no fd
-			    0);  // no offset
-
-	if (region->region == MAP_FAILED) {
-		free(region);
+	region->region = (void *)region + REGION_HEADER_SIZE;
+	region->end = (void *)region + heap->region_size;
+	region->allocated = region->region;
+	region->object_count = 0;
+}
+
+static struct PupHeapRegion *region_at(struct PupHeap *heap, size_t index)
+{
+	return (struct PupHeapRegion *)(heap->reserved_start
+	                                + (index << heap->region_shift));
+}
+
+size_t pup_heap_region_index(struct PupHeap *heap,
+                             struct PupHeapRegion *region)
+{
+	return ((void *)region - heap->reserved_start) >> heap->region_shift;
+}
+
+size_t pup_heap_region_count(struct PupHeap *heap)
+{
+	return heap->region_count;
+}
+
+bool pup_heap_contains(struct PupHeap *heap, const void *ptr)
+{
+	// a single unsigned comparison covers both ends of the range,
+	return (size_t)(ptr - heap->reserved_start) < heap->reserved_size;
+}
+
+struct PupHeapRegion *pup_heap_region_containing(struct PupHeap *heap,
+                                                 const void *ptr)
+{
+	if (!pup_heap_contains(heap, ptr)) {
 		return NULL;
 	}
-	region->end = region->region + REGION_SIZE;
-	region->allocated = region->region;
-	region->read_only = false;
-	return region;
+	return (struct PupHeapRegion *)((AO_t)ptr & ~(AO_t)(heap->region_size-1));
 }
 
-static size_t alloc_size_for(size_t request_size)
+static void set_region_state(struct PupHeap *heap,
+                             struct PupHeapRegion *region,
+                             enum RegionState state)
+{
+	heap->region_state[pup_heap_region_index(heap, region)] = state;
+}
+
+static struct HeapObject *heap_object_of(const void *data)
+{
+	return (struct HeapObject *)(data - offsetof(struct HeapObject, data));
+}
+
+static size_t heap_object_size(const struct HeapObject *obj)
 {
-	return request_size + sizeof(struct HeapObject);
+	return (size_t)obj->granules << MARK_GRANULE_SHIFT;
 }
 
 static void destroy_region_objects(struct PupHeapRegion *region)
@@ -86,17 +171,372 @@ static void destroy_region_objects(struct PupHeapRegion *region)
 		    case PUP_KIND_OBJ:
 			pup_object_destroy((struct PupObject *)obj->data);
 		}
-		ptr += alloc_size_for(obj->object_size);
+		ptr += heap_object_size(obj);
+	}
+}
+
+/*
+ * Garbage-only regions found by the sweep are reclaimed here, by the
+ * allocating thread, rather than by the collector.
+ */
+static struct PupHeapRegion *region_reclaim_take(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	struct PupHeapRegion *region = heap->reclaim_list;
+	if (region) {
+		heap->reclaim_list = (struct PupHeapRegion *)region->next;
+		set_region_state(heap, region, REGION_IN_USE);
+	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	if (region) {
+		// the dead objects are about to be overwritten,
+		destroy_region_objects(region);
+	}
+	return region;
+}
+
+static void region_reclaim_defer(struct PupHeap *heap,
+                                 struct PupHeapRegion *region)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	region->next = (AO_t)heap->reclaim_list;
+	heap->reclaim_list = region;
+	set_region_state(heap, region, REGION_RECLAIMABLE);
+	pthread_mutex_unlock(&heap->region_pool_lock);
+}
+
+static struct PupHeapRegion *region_pool_take(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	struct PupHeapRegion *region = heap->region_pool;
+	if (region) {
+		heap->region_pool = (struct PupHeapRegion *)region->next;
+		heap->region_pool_size--;
+		heap->region_pool_stats.hits++;
+		set_region_state(heap, region, REGION_IN_USE);
+	} else {
+		heap->region_pool_stats.misses++;
 	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	return region;
 }
 
-static void free_region(struct PupHeapRegion *region)
+/*
+ * Claims an uncommitted slot of the heap's reserved address range, and
+ * makes it accessible.  Returns NULL once the whole range is in use.
+ */
+static struct PupHeapRegion *region_map(struct PupHeap *heap)
+{
+	struct PupHeapRegion *region = NULL;
+	pthread_mutex_lock(&heap->region_pool_lock);
+	for (size_t i=0; i < heap->region_count; i++) {
+		size_t index = (heap->region_search_hint + i) % heap->region_count;
+		if (heap->region_state[index] == REGION_UNCOMMITTED) {
+			heap->region_state[index] = REGION_IN_USE;
+			heap->region_search_hint = index + 1;
+			region = region_at(heap, index);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	if (!region) {
+		return NULL;
+	}
+	if (mprotect(region, heap->region_size, PROT_READ|PROT_WRITE)) {
+		pthread_mutex_lock(&heap->region_pool_lock);
+		set_region_state(heap, region, REGION_UNCOMMITTED);
+		pthread_mutex_unlock(&heap->region_pool_lock);
+		return NULL;
+	}
+	return region;
+}
+
+struct PupHeapRegion *pup_heap_region_allocate(struct PupHeap *heap)
+{
+	struct PupHeapRegion *region = region_reclaim_take(heap);
+	if (!region) {
+		region = region_pool_take(heap);
+	}
+	if (!region) {
+		region = region_map(heap);
+		if (!region) {
+			return NULL;
+		}
+	}
+	region_init(heap, region);
+	return region;
+}
+
+static size_t alloc_size_for(size_t request_size)
+{
+	return (request_size + sizeof(struct HeapObject) + MARK_GRANULE - 1)
+	       & ~(size_t)(MARK_GRANULE - 1);
+}
+
+enum PupHeapKind pup_heap_kind_of(const void *obj)
+{
+	return heap_object_of(obj)->kind;
+}
+
+static size_t granule_index(struct PupHeap *heap, const void *addr)
+{
+	return (addr - heap->reserved_start) >> MARK_GRANULE_SHIFT;
+}
+
+static AO_t *mark_word(struct PupHeap *heap, int mark, const void *obj,
+                       AO_t *bit)
+{
+	size_t granule = granule_index(heap, heap_object_of(obj));
+	*bit = (AO_t)1 << (granule % BITS_PER_WORD);
+	return &heap->mark_bitmaps[mark][granule / BITS_PER_WORD];
+}
+
+bool pup_heap_mark(struct PupHeap *heap, const void *obj, int mark)
+{
+	AO_t bit;
+	AO_t *word = mark_word(heap, mark, obj, &bit);
+	// other markers (and allocating mutators) may be updating other bits
+	// of the same word,
+	while (true) {
+		AO_t old = AO_load(word);
+		if (old & bit) {
+			return false;
+		}
+		if (AO_compare_and_swap(word, old, old | bit)) {
+			return true;
+		}
+	}
+}
+
+void pup_heap_clear_marks(struct PupHeap *heap, int mark)
+{
+	// the bitmaps are private anonymous mappings, so this gives us fresh
+	// zero pages without having to write to the whole bitmap
+	if (madvise(heap->mark_bitmaps[mark], heap->mark_bitmap_size,
+	            MADV_DONTNEED))
+	{
+		memset(heap->mark_bitmaps[mark], 0, heap->mark_bitmap_size);
+	}
+}
+
+/*
+ * Gives the region's pages back to the OS and returns its slot of the
+ * reserved address range to the uncommitted state.
+ */
+static void region_unmap(struct PupHeap *heap, struct PupHeapRegion *region)
+{
+	if (madvise(region, heap->region_size, MADV_DONTNEED)) {
+		fprintf(stderr, "madvise(%p, %zu) unexpectedly failed: %s", region, heap->region_size, strerror(errno));
+	}
+	if (mprotect(region, heap->region_size, PROT_NONE)) {
+		fprintf(stderr, "mprotect(%p, %zu) unexpectedly failed: %s", region, heap->region_size, strerror(errno));
+	}
+	pthread_mutex_lock(&heap->region_pool_lock);
+	set_region_state(heap, region, REGION_UNCOMMITTED);
+	pthread_mutex_unlock(&heap->region_pool_lock);
+}
+
+/*
+ * Returns the pages of a pooled region to the OS, while keeping the page
+ * holding the region descriptor (and so the pool's list linkage).
+ */
+static size_t region_dontneed(struct PupHeap *heap,
+                              struct PupHeapRegion *region)
+{
+	size_t page_size = getpagesize();
+	if (madvise((void *)region + page_size,
+	            heap->region_size - page_size,
+	            MADV_DONTNEED))
+	{
+		return 0;
+	}
+	return heap->region_size - page_size;
+}
+
+static void region_release(struct PupHeap *heap, struct PupHeapRegion *region)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	if (heap->region_pool_size < heap->region_pool_limit) {
+		if (heap->region_pool_dontneed) {
+			heap->region_pool_stats.bytes_released
+				+= region_dontneed(heap, region);
+		}
+		region->next = (AO_t)heap->region_pool;
+		heap->region_pool = region;
+		heap->region_pool_size++;
+		set_region_state(heap, region, REGION_POOLED);
+		pthread_mutex_unlock(&heap->region_pool_lock);
+		return;
+	}
+	heap->region_pool_stats.bytes_released += heap->region_size;
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	region_unmap(heap, region);
+}
+
+static void free_region(struct PupHeap *heap, struct PupHeapRegion *region)
 {
 	destroy_region_objects(region);
-	if (munmap(region->region, REGION_SIZE)) {
-		fprintf(stderr, "munmap(%p, %d) unexpectedly failed: %s", region->region, REGION_SIZE, strerror(errno));
+	region_release(heap, region);
+}
+
+static void mark_bitmaps_destroy(struct PupHeap *heap)
+{
+	for (int i=0; i<2; i++) {
+		if (heap->mark_bitmaps[i]) {
+			munmap(heap->mark_bitmaps[i], heap->mark_bitmap_size);
+		}
+	}
+}
+
+/*
+ * One bitmap for each of the two alternating mark values, each covering
+ * the whole reserved range.  Pages of the bitmaps are only populated once
+ * objects in the corresponding part of the heap get marked.
+ */
+static int mark_bitmaps_init(struct PupHeap *heap)
+{
+	heap->mark_bitmap_size = heap->reserved_size / MARK_GRANULE / 8;
+	for (int i=0; i<2; i++) {
+		void *mem = mmap(NULL,
+		                 heap->mark_bitmap_size,
+		                 PROT_READ|PROT_WRITE,
+		                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+		                 -1,  // no fd
+		                 0);  // no offset
+		heap->mark_bitmaps[i] = mem == MAP_FAILED ? NULL : mem;
+	}
+	if (!heap->mark_bitmaps[0] || !heap->mark_bitmaps[1]) {
+		mark_bitmaps_destroy(heap);
+		return -1;
+	}
+	return 0;
+}
+
+static void regions_destroy(struct PupHeap *heap)
+{
+	// pooled and reclaimable regions go away along with the rest of the
+	// reservation,
+	heap->reclaim_list = NULL;
+	heap->large_objects = NULL;
+	heap->region_pool = NULL;
+	heap->region_pool_size = 0;
+	if (munmap(heap->reserved_start, heap->reserved_size)) {
+		fprintf(stderr, "munmap(%p, %zu) unexpectedly failed: %s", heap->reserved_start, heap->reserved_size, strerror(errno));
+	}
+	free(heap->region_state);
+	mark_bitmaps_destroy(heap);
+	pthread_mutex_destroy(&heap->region_pool_lock);
+}
+
+static size_t heap_max_size(size_t region_size)
+{
+	const char *max_mb = getenv("PUP_HEAP_MAX_MB");
+	size_t size = (max_mb ? strtoul(max_mb, NULL, 10)
+	                      : DEFAULT_HEAP_MAX_MB) << 20;
+	// round up to a whole number of regions,
+	size = (size + region_size - 1) & ~(region_size - 1);
+	return size ? size : region_size;
+}
+
+/*
+ * Reserves (without committing) a region-aligned range of address
+ * space for the whole heap, so that the region holding any heap address
+ * can be found just by masking off the low bits.
+ */
+static int heap_reserve(struct PupHeap *heap)
+{
+	size_t size = heap_max_size(heap->region_size);
+	// over-reserve by one region so that an aligned range of 'size' bytes
+	// is sure to fit, then trim off the excess at either end
+	void *mem = mmap(NULL,
+	                 size + heap->region_size,
+	                 PROT_NONE,
+	                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,
+	                 -1,  // no fd
+	                 0);  // no offset
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
+	void *start = (void *)(((AO_t)mem + heap->region_size - 1)
+	                       & ~(AO_t)(heap->region_size - 1));
+	if (start > mem) {
+		munmap(mem, start - mem);
+	}
+	if (start + size < mem + size + heap->region_size) {
+		munmap(start + size, (mem + size + heap->region_size) - (start + size));
+	}
+	heap->reserved_start = start;
+	heap->reserved_size = size;
+	if (heap->huge_pages) {
+		// only advisory; the kernel may not support THP, or may have
+		// it disabled, in which case we just get normal pages
+		if (madvise(start, size, MADV_HUGEPAGE)) {
+			fprintf(stderr, "madvise(MADV_HUGEPAGE) failed: %s\n", strerror(errno));
+		}
+	}
+	heap->region_count = size >> heap->region_shift;
+	heap->region_search_hint = 0;
+	heap->region_state = calloc(heap->region_count, 1);
+	if (!heap->region_state) {
+		munmap(start, size);
+		return -1;
+	}
+	if (mark_bitmaps_init(heap)) {
+		free(heap->region_state);
+		munmap(start, size);
+		return -1;
+	}
+	return 0;
+}
+
+static void region_size_init(struct PupHeap *heap)
+{
+	heap->huge_pages = getenv("PUP_HEAP_HUGE_PAGES") != NULL;
+	heap->region_shift = heap->huge_pages ? HUGE_PAGE_REGION_SHIFT
+	                                      : DEFAULT_REGION_SHIFT;
+	const char *shift = getenv("PUP_HEAP_REGION_SHIFT");
+	if (shift) {
+		heap->region_shift = atoi(shift);
+		ABORTF_ON(heap->region_shift < MIN_REGION_SHIFT,
+		          "PUP_HEAP_REGION_SHIFT must be at least %d",
+		          MIN_REGION_SHIFT);
 	}
-	free(region);
+	heap->region_size = (size_t)1 << heap->region_shift;
+}
+
+static int regions_init(struct PupHeap *heap)
+{
+	region_size_init(heap);
+	int res = heap_reserve(heap);
+	if (res) {
+		return res;
+	}
+	res = pthread_mutex_init(&heap->region_pool_lock, NULL);
+	if (res) {
+		munmap(heap->reserved_start, heap->reserved_size);
+		free(heap->region_state);
+		mark_bitmaps_destroy(heap);
+		return res;
+	}
+	heap->reclaim_list = NULL;
+	heap->large_objects = NULL;
+	heap->region_pool = NULL;
+	heap->region_pool_size = 0;
+	const char *limit = getenv("PUP_HEAP_REGION_POOL");
+	heap->region_pool_limit = limit ? atoi(limit)
+	                                : DEFAULT_REGION_POOL_LIMIT;
+	heap->region_pool_dontneed
+		= getenv("PUP_HEAP_REGION_POOL_DONTNEED") != NULL;
+	memset(&heap->region_pool_stats, 0, sizeof(heap->region_pool_stats));
+	return 0;
+}
+
+void pup_heap_get_region_pool_stats(struct PupHeap *heap,
+                                    struct PupHeapRegionPoolStats *stats)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	*stats = heap->region_pool_stats;
+	pthread_mutex_unlock(&heap->region_pool_lock);
 }
 
 static struct PupThreadInfo *get_thread_info(struct PupHeap *heap)
@@ -142,6 +582,7 @@ static void attach_thread_to_heap(struct PupHeap *heap,
 	while (true) {
 		struct PupThreadInfo *old_head
 			= get_thread_list_head(heap);
+		AO_store(&new_head->next, (AO_t)old_head);
 		if (swap_thread_list_head(heap, old_head, new_head)) {
 			return;
 		}
@@ -159,17 +600,22 @@ static int attach_thread(struct PupHeap *heap, pthread_t thread)
 	AO_store(&tinfo->next, 0);
 	ANNOTATE_HAPPENS_BEFORE(&tinfo->next);
 	tinfo->gc_waiting = false;
+	tinfo->current_gc_mark = 0;
+	tinfo->satb_buffer = NULL;
+	tinfo->bytes_allocated = 0;
 	if (set_thread_info(heap, tinfo)) {
 		return -1;
 	}
+	pthread_mutex_lock(&heap->threads_lock);
 	attach_thread_to_heap(heap, tinfo);
+	pthread_mutex_unlock(&heap->threads_lock);
 	ANNOTATE_THREAD_NAME("mutator");
 	return 0;
 }
 
 int pup_heap_thread_init(struct PupHeap *heap)
 {
-	struct PupHeapRegion *region = pup_heap_region_allocate();
+	struct PupHeapRegion *region = pup_heap_region_allocate(heap);
 	if (!region) {
 		return -1;
 	}
@@ -185,6 +631,17 @@ int pup_heap_thread_init(struct PupHeap *heap)
 	return 0;
 }
 
+// must be called with threads_lock held
+static void detach_thread_from_heap(struct PupHeap *heap,
+                                    struct PupThreadInfo *tinfo)
+{
+	volatile AO_t *link = &heap->thread_list;
+	while ((struct PupThreadInfo *)AO_load(link) != tinfo) {
+		link = &((struct PupThreadInfo *)AO_load(link))->next;
+	}
+	AO_store(link, AO_load(&tinfo->next));
+}
+
 static void safepoint_barrier_wait(struct PupHeap *heap)
 {
 	int res = pthread_barrier_wait(&heap->safepoint_barrier);
@@ -196,8 +653,10 @@ static void safepoint_barrier_wait(struct PupHeap *heap)
 static void announce_mutator_arrival(struct PupHeap *heap,
                                      struct PupThreadInfo *tinfo)
 {
-	safepoint_barrier_wait(heap);
+	// cleared first, since once we pass the barrier the collector may
+	// already be signalling us for its next phase
 	tinfo->gc_waiting = false;
+	safepoint_barrier_wait(heap);
 }
 
 static struct PupGCState *get_gc_state(struct PupHeap *heap)
@@ -206,6 +665,75 @@ static struct PupGCState *get_gc_state(struct PupHeap *heap)
 	return (struct PupGCState *)AO_load((AO_t *)&heap->gc_state);
 }
 
+static double now_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void record_pause(struct PupHeap *heap, double usec)
+{
+	pthread_mutex_lock(&heap->stats_lock);
+	struct PupGCStats *stats = &heap->gc_stats;
+	if (!stats->pause_count || usec < stats->pause_min_us) {
+		stats->pause_min_us = usec;
+	}
+	if (usec > stats->pause_max_us) {
+		stats->pause_max_us = usec;
+	}
+	stats->pause_count++;
+	heap->pause_total_us += usec;
+	pthread_mutex_unlock(&heap->stats_lock);
+	// bucket i counts pauses of [2^i, 2^(i+1)) microseconds,
+	int bucket = 0;
+	while (usec >= 2 && bucket < PUP_GC_PAUSE_BUCKETS-1) {
+		usec /= 2;
+		bucket++;
+	}
+	AO_fetch_and_add1(&heap->pause_histogram[bucket]);
+}
+
+/*
+ * While the collector holds mutators (for the root snapshot and remark
+ * pauses, or the whole of marking in stop-the-world mode), each one waits
+ * here after arriving at its safepoint.
+ */
+static unsigned long current_hold(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->hold_lock);
+	unsigned long hold = heap->hold_generation;
+	pthread_mutex_unlock(&heap->hold_lock);
+	return hold;
+}
+
+static void wait_while_held(struct PupHeap *heap, unsigned long hold)
+{
+	// the collector may already have released this hold and started the
+	// next, which is not ours to wait for
+	pthread_mutex_lock(&heap->hold_lock);
+	while (heap->holding_mutators && heap->hold_generation == hold) {
+		pthread_cond_wait(&heap->hold_released, &heap->hold_lock);
+	}
+	pthread_mutex_unlock(&heap->hold_lock);
+}
+
+static void hold_mutators(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->hold_lock);
+	heap->hold_generation++;
+	heap->holding_mutators = true;
+	pthread_mutex_unlock(&heap->hold_lock);
+}
+
+static void release_mutators(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->hold_lock);
+	heap->holding_mutators = false;
+	pthread_cond_broadcast(&heap->hold_released);
+	pthread_mutex_unlock(&heap->hold_lock);
+}
+
 void pup_heap_safepoint(struct PupHeap *heap)
 {
 	struct PupThreadInfo *tinfo = get_thread_info(heap);
@@ -213,8 +741,149 @@ void pup_heap_safepoint(struct PupHeap *heap)
 	// this thread, hence we don't use explicit atomic ops or locking
 	// for this access
 	if (tinfo->gc_waiting) {
-		pup_gc_scan_stack(get_gc_state(heap));
+		double start = now_usec();
+		AO_fetch_and_add(&heap->bytes_allocated, tinfo->bytes_allocated);
+		tinfo->bytes_allocated = 0;
+		struct PupGCState *gc_state = get_gc_state(heap);
+		if (AO_load(&heap->gc_phase) == GC_PHASE_ROOTS) {
+			pup_gc_scan_stack(gc_state);
+			// only once our roots are in the snapshot may new
+			// allocations be treated as live without being traced;
+			// until then they must stay unmarked, or whatever they
+			// reference would be missed
+			tinfo->current_gc_mark =
+				pup_gc_get_current_mark(gc_state);
+		}
+		// any references logged before the root snapshot are
+		// redundant, but harmless
+		pup_gc_satb_flush(gc_state, &tinfo->satb_buffer);
+		unsigned long hold = current_hold(heap);
 		announce_mutator_arrival(heap, tinfo);
+		wait_while_held(heap, hold);
+		record_pause(heap, now_usec() - start);
+	}
+}
+
+void pup_heap_pre_write_barrier(struct PupHeap *heap, void *old_value)
+{
+	if (!old_value || !AO_load(&heap->marking_active)) {
+		return;
+	}
+	struct PupThreadInfo *tinfo = get_thread_info(heap);
+	pup_gc_satb_log(get_gc_state(heap), &tinfo->satb_buffer, old_value);
+}
+
+void pup_heap_thread_exit(struct PupHeap *heap)
+{
+	struct PupThreadInfo *tinfo = get_thread_info(heap);
+	// the gc thread holds threads_lock while it waits for mutators to
+	// reach a safepoint, which may include us
+	struct timespec poll = {
+		.tv_sec = 0,
+		.tv_nsec = 1000000
+	};
+	while (pthread_mutex_trylock(&heap->threads_lock)) {
+		pup_heap_safepoint(heap);
+		nanosleep(&poll, NULL);
+	}
+	// hand over what the collector would have taken at our next
+	// safepoint; before unlocking, so that any remark still to come
+	// sees it
+	pup_gc_satb_flush(get_gc_state(heap), &tinfo->satb_buffer);
+	AO_fetch_and_add(&heap->bytes_allocated, tinfo->bytes_allocated);
+	detach_thread_from_heap(heap, tinfo);
+	pthread_mutex_unlock(&heap->threads_lock);
+	pup_heap_add_to_global_heap(heap, tinfo->local_region);
+	pthread_setspecific(heap->this_thread_info, NULL);
+	free(tinfo);
+}
+
+int pup_heap_backtrace(struct PupHeap *heap, void **addrs, int max)
+{
+	struct PupGCState *gc_state = get_gc_state(heap);
+	if (!gc_state) {
+		return 0;
+	}
+	return pup_gc_backtrace(gc_state, addrs, max);
+}
+
+void pup_heap_get_pause_histogram(struct PupHeap *heap,
+                                  unsigned long *buckets)
+{
+	for (int i=0; i<PUP_GC_PAUSE_BUCKETS; i++) {
+		buckets[i] = AO_load(&heap->pause_histogram[i]);
+	}
+}
+
+// the upper bound of the histogram bucket holding the 99th percentile,
+static double pause_p99_us(struct PupHeap *heap, unsigned long count)
+{
+	unsigned long buckets[PUP_GC_PAUSE_BUCKETS];
+	pup_heap_get_pause_histogram(heap, buckets);
+	unsigned long seen = 0;
+	for (int i=0; i<PUP_GC_PAUSE_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen * 100 >= count * 99) {
+			return (double)(2UL << i);
+		}
+	}
+	return (double)(1UL << PUP_GC_PAUSE_BUCKETS);
+}
+
+static unsigned long regions_in_use(struct PupHeap *heap)
+{
+	unsigned long count = 0;
+	pthread_mutex_lock(&heap->region_pool_lock);
+	for (size_t i=0; i<heap->region_count; i++) {
+		if (heap->region_state[i] == REGION_IN_USE
+		    || heap->region_state[i] == REGION_LARGE_TAIL)
+		{
+			count++;
+		}
+	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	return count;
+}
+
+void pup_heap_get_gc_stats(struct PupHeap *heap, struct PupGCStats *stats)
+{
+	pthread_mutex_lock(&heap->stats_lock);
+	*stats = heap->gc_stats;
+	if (stats->pause_count) {
+		stats->pause_avg_us = heap->pause_total_us / stats->pause_count;
+	}
+	if (heap->time_to_safepoint_count) {
+		stats->time_to_safepoint_avg_us =
+			heap->time_to_safepoint_total_us
+			/ heap->time_to_safepoint_count;
+	}
+	pthread_mutex_unlock(&heap->stats_lock);
+	if (stats->pause_count) {
+		double p99 = pause_p99_us(heap, stats->pause_count);
+		stats->pause_p99_us = p99 < stats->pause_max_us ? p99
+		                                                : stats->pause_max_us;
+	}
+	// a mutator asking sees its own allocations so far too,
+	struct PupThreadInfo *tinfo =
+		pthread_getspecific(heap->this_thread_info);
+	stats->bytes_allocated = AO_load(&heap->bytes_allocated)
+	                         + (tinfo ? tinfo->bytes_allocated : 0);
+	stats->regions_freed = AO_load(&heap->regions_freed);
+	stats->regions_in_use = regions_in_use(heap);
+}
+
+static void print_pause_histogram(struct PupHeap *heap)
+{
+	unsigned long buckets[PUP_GC_PAUSE_BUCKETS];
+	pup_heap_get_pause_histogram(heap, buckets);
+	fprintf(stderr, "GC pauses (%s marking):\n",
+	        heap->gc_stop_the_world ? "stop-the-world" : "concurrent");
+	for (int i=0; i<PUP_GC_PAUSE_BUCKETS; i++) {
+		if (buckets[i]) {
+			fprintf(stderr, "  %8lu-%lu us: %lu\n",
+			        i ? 1UL << i : 0, (1UL << (i+1)) - 1,
+			        buckets[i]);
+		}
 	}
 }
 
@@ -230,7 +899,7 @@ static void converge_on_safepoint(struct PupHeap *heap,
 	union sigval sv;
 	sv.sival_ptr = heap;
 	pthread_t thread = get_thread(tinfo);
-	fprintf(stderr, "converge_on_safepoint() signalling %p\n", (void *)thread);
+	PUP_GC_EVENT(2, PUP_GC_EV_SAFEPOINT_REQUEST, thread, 0);
 	int ret = pthread_sigqueue(thread, SIGUSR1, sv);
 	ABORTF_ON(ret, "sigqueue() failed: %s", strerror(errno));
 	safepoint_barrier_wait(heap);
@@ -256,6 +925,13 @@ static struct PupHeapRegion *region_next(struct PupHeapRegion *r)
 	return (struct PupHeapRegion *)AO_load(&r->next);
 }
 
+static void set_region_next(struct PupHeapRegion *region,
+                            struct PupHeapRegion *next)
+{
+	AO_store(&region->next, (AO_t)next);
+	ANNOTATE_HAPPENS_BEFORE(&region->next);
+}
+
 static struct PupHeapRegion *steal_heap_region(struct PupHeap *heap)
 {
 	while (true) {
@@ -285,55 +961,244 @@ static void collect_heap_object(struct HeapObject *obj,
 		ABORTF("Unknown object kind %d", obj->kind);
 	}
 }
-static void prevent_mutator_access(struct PupHeap *heap,
-                                   struct PupHeapRegion *region)
+static void *atomic_region_start(struct PupHeapRegion *region)
 {
-	region->read_only = true;
-	// Prevent mutators being from writing to objects in this region while
-	// we copy the live objects out.  Mutators attempting such writes
-	// will be interrupted with SIGBUS, which we have to handle
-	// TODO: write SIGBUS handling
-	int res = mprotect(region->region,
-	                   region->end - region->region,
-	                   PROT_READ);
-	ABORTF_ON(res, "mprotect failed: %s", strerror(errno));
+	return (void *)AO_load((AO_t *)&region->region);
 }
 
-static void *atomic_region_start(struct PupHeapRegion *region)
+static AO_t *region_mark_words(struct PupHeap *heap,
+                               struct PupHeapRegion *region,
+                               size_t *first_word,
+                               size_t *end_word)
 {
-	return (void *)AO_load((AO_t *)&region->region);
+	struct PupGCState *state = get_gc_state(heap);
+	size_t first = granule_index(heap, atomic_region_start(region));
+	size_t last = granule_index(heap, region->allocated);
+	*first_word = first / BITS_PER_WORD;
+	*end_word = (last + BITS_PER_WORD - 1) / BITS_PER_WORD;
+	return heap->mark_bitmaps[pup_gc_get_current_mark(state)];
+}
+
+static bool region_has_marks(struct PupHeap *heap,
+                             struct PupHeapRegion *region)
+{
+	size_t w, end;
+	AO_t *bitmap = region_mark_words(heap, region, &w, &end);
+	for (; w < end; w++) {
+		if (bitmap[w]) {
+			return true;
+		}
+	}
+	return false;
 }
 
 static void collect_unmarked_objects_in_region(struct PupHeap *heap,
                                                struct PupHeapRegion *region)
 {
-	// make sure mutator threads can't alter objects in the process of
-	// being copied
-	// TODO: would it be a win to only if this if we find a live object
-	//       in the region (i.e. there as actually a possibility of
-	//       mutator access)?
-	// FIXME: Where to unprotect the region again?
-	prevent_mutator_access(heap, region);
+	// copy_live_object() doesn't evacuate anything yet, so mutators are
+	// free to go on writing to the live objects here as the region is swept
+
+	// only marked objects need visiting, so rather than walking every
+	// object we just walk the set bits of the region's part of the mark
+	// bitmap
+	struct PupGCState *state = get_gc_state(heap);
+	size_t w, end;
+	AO_t *bitmap = region_mark_words(heap, region, &w, &end);
+	int live = 0;
+	for (; w < end; w++) {
+		AO_t bits = bitmap[w];
+		while (bits) {
+			size_t granule = w * BITS_PER_WORD
+			                 + __builtin_ctzl(bits);
+			bits &= bits - 1;
+			struct HeapObject *obj = heap->reserved_start
+				+ (granule << MARK_GRANULE_SHIFT);
+			collect_heap_object(obj, state);
+			// object_count counts objects only, but attribute
+			// entries and String buffers are marked too
+			if (obj->kind == PUP_KIND_OBJ) {
+				live++;
+			}
+		}
+	}
+	pup_gc_add_garbage_count(state, region->object_count - live);
+}
+
+static void sweep_region(struct PupHeap *heap, struct PupHeapRegion *region)
+{
+	if (!region_has_marks(heap, region)) {
+		// nothing to copy out; just leave it for the allocator to reuse
+		pup_gc_add_garbage_count(get_gc_state(heap),
+		                         region->object_count);
+		region_reclaim_defer(heap, region);
+		AO_fetch_and_add1(&heap->regions_freed);
+		return;
+	}
+	collect_unmarked_objects_in_region(heap, region);
+	// copy_live_object() doesn't evacuate anything yet, so the live
+	// objects are all still here; keep the region rather than handing it
+	// out for reuse underneath them
+	pup_heap_add_to_global_heap(heap, region);
+}
 
-	void *addr;
-	for (addr=atomic_region_start(region); addr < region->allocated; ) {
-		struct HeapObject *obj = addr;
-		collect_heap_object(obj, get_gc_state(heap));
-		addr += alloc_size_for(obj->object_size);
+static struct PupHeapRegion *take_sweep_region(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->sweep_lock);
+	struct PupHeapRegion *region = heap->sweep_list;
+	if (region) {
+		heap->sweep_list = region_next(region);
+	}
+	pthread_mutex_unlock(&heap->sweep_lock);
+	return region;
+}
+
+static void sweep_regions(struct PupHeap *heap)
+{
+	struct PupHeapRegion *region;
+	while ((region = take_sweep_region(heap))) {
+		sweep_region(heap, region);
+	}
+}
+
+static void *sweep_thread(void *arg)
+{
+	struct PupHeap *heap = (struct PupHeap *)arg;
+	ANNOTATE_THREAD_NAME("gc-sweeper");
+	unsigned long done_generation = 0;
+	pthread_mutex_lock(&heap->sweep_lock);
+	while (true) {
+		while (!heap->sweep_shutdown
+		       && heap->sweep_generation == done_generation)
+		{
+			pthread_cond_wait(&heap->sweep_start, &heap->sweep_lock);
+		}
+		if (heap->sweep_shutdown) {
+			break;
+		}
+		done_generation = heap->sweep_generation;
+		pthread_mutex_unlock(&heap->sweep_lock);
+		sweep_regions(heap);
+		pthread_mutex_lock(&heap->sweep_lock);
+		if (--heap->sweep_busy == 0) {
+			pthread_cond_signal(&heap->sweep_done);
+		}
+	}
+	pthread_mutex_unlock(&heap->sweep_lock);
+	return NULL;
+}
+
+/*
+ * Garbage-only regions from the last collection which no allocation
+ * got around to reusing are released now, so they don't build up.
+ */
+static void release_reclaimable_regions(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->region_pool_lock);
+	struct PupHeapRegion *region = heap->reclaim_list;
+	heap->reclaim_list = NULL;
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	while (region) {
+		struct PupHeapRegion *next = (struct PupHeapRegion *)region->next;
+		free_region(heap, region);
+		region = next;
+	}
+}
+
+static void large_region_unmap(struct PupHeap *heap,
+                               struct PupHeapRegion *region)
+{
+	size_t size = region->end - (void *)region;
+	if (madvise(region, size, MADV_DONTNEED)) {
+		fprintf(stderr, "madvise(%p, %zu) unexpectedly failed: %s", region, size, strerror(errno));
+	}
+	if (mprotect(region, size, PROT_NONE)) {
+		fprintf(stderr, "mprotect(%p, %zu) unexpectedly failed: %s", region, size, strerror(errno));
+	}
+	size_t first = pup_heap_region_index(heap, region);
+	pthread_mutex_lock(&heap->region_pool_lock);
+	for (size_t i=first; i < first + (size >> heap->region_shift); i++) {
+		heap->region_state[i] = REGION_UNCOMMITTED;
+	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+}
+
+/*
+ * Large objects stay where they are; the run of regions holding an
+ * unmarked one is just given back.
+ */
+static void sweep_large_objects(struct PupHeap *heap)
+{
+	struct PupGCState *state = get_gc_state(heap);
+	pthread_mutex_lock(&heap->region_pool_lock);
+	struct PupHeapRegion *region = heap->large_objects;
+	heap->large_objects = NULL;
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	struct PupHeapRegion *live = NULL;
+	struct PupHeapRegion *live_tail = NULL;
+	while (region) {
+		struct PupHeapRegion *next = (struct PupHeapRegion *)region->next;
+		if (region_has_marks(heap, region)) {
+			pup_gc_inc_live_count(state);
+			region->next = (AO_t)live;
+			live = region;
+			if (!live_tail) {
+				live_tail = region;
+			}
+		} else {
+			pup_gc_add_garbage_count(state, region->object_count);
+			destroy_region_objects(region);
+			large_region_unmap(heap, region);
+			AO_fetch_and_add1(&heap->regions_freed);
+		}
+		region = next;
+	}
+	if (live) {
+		// mutators may have allocated more large objects meanwhile,
+		pthread_mutex_lock(&heap->region_pool_lock);
+		live_tail->next = (AO_t)heap->large_objects;
+		heap->large_objects = live;
+		pthread_mutex_unlock(&heap->region_pool_lock);
 	}
 }
 
 static void collect_unmarked_objects(struct PupHeap *heap)
 {
+	release_reclaimable_regions(heap);
+	// regions are independent of each other, so they are shared out
+	// between the sweeper threads and this one
+	struct PupHeapRegion *list = NULL;
 	struct PupHeapRegion *region;
 	while ((region = steal_heap_region(heap))) {
-		collect_unmarked_objects_in_region(heap, region);
-		// reset the allocation for this region so that no object
-		// freeing will occur,
-		region->allocated = region->region;
-		// release this region's memory,
-		free_region(region);
+		set_region_next(region, list);
+		list = region;
 	}
+	pthread_mutex_lock(&heap->sweep_lock);
+	heap->sweep_list = list;
+	heap->sweep_busy = heap->sweep_thread_count;
+	heap->sweep_generation++;
+	pthread_cond_broadcast(&heap->sweep_start);
+	pthread_mutex_unlock(&heap->sweep_lock);
+
+	sweep_regions(heap);
+
+	sweep_large_objects(heap);
+
+	pthread_mutex_lock(&heap->sweep_lock);
+	while (heap->sweep_busy) {
+		pthread_cond_wait(&heap->sweep_done, &heap->sweep_lock);
+	}
+	pthread_mutex_unlock(&heap->sweep_lock);
+}
+
+static void record_time_to_safepoint(struct PupHeap *heap, double usec)
+{
+	pthread_mutex_lock(&heap->stats_lock);
+	if (usec > heap->gc_stats.time_to_safepoint_max_us) {
+		heap->gc_stats.time_to_safepoint_max_us = usec;
+	}
+	heap->time_to_safepoint_total_us += usec;
+	heap->time_to_safepoint_count++;
+	pthread_mutex_unlock(&heap->stats_lock);
 }
 
 static struct PupThreadInfo *threadinfo_next(
@@ -343,23 +1208,82 @@ static struct PupThreadInfo *threadinfo_next(
 	return (struct PupThreadInfo *)AO_load(&tinfo->next);
 }
 
-static void perform_gc(struct PupHeap *heap)
+/*
+ * Brings every mutator to a safepoint, where it performs the given phase's
+ * work and is then held until release_mutators().
+ */
+static void stop_mutators(struct PupHeap *heap, enum GCPhase phase)
 {
-	struct PupGCState *gc_state = get_gc_state(heap);
-	pup_gc_period_start(gc_state);
+	double start = now_usec();
+	AO_store(&heap->gc_phase, phase);
+	hold_mutators(heap);
+	pthread_mutex_lock(&heap->threads_lock);
 	for (struct PupThreadInfo *tinfo = get_thread_list_head(heap);
 	     tinfo;
 	     tinfo = threadinfo_next(tinfo))
 	{
 		converge_on_safepoint(heap, tinfo);
 	}
+	pthread_mutex_unlock(&heap->threads_lock);
+	record_time_to_safepoint(heap, now_usec() - start);
+}
+
+static void scan_registered_roots(struct PupHeap *heap,
+                                  struct PupGCState *gc_state)
+{
+	pthread_mutex_lock(&heap->roots_lock);
+	pup_gc_scan_roots(gc_state, heap->roots, heap->root_count);
+	pup_gc_scan_root_objects(gc_state, heap->root_objects,
+	                         heap->root_object_count);
+	pthread_mutex_unlock(&heap->roots_lock);
+}
+
+static void record_cycle(struct PupHeap *heap, struct PupGCState *gc_state)
+{
+	int live = pup_gc_get_live_count(gc_state);
+	int examined = live + pup_gc_get_garbage_count(gc_state);
+	pthread_mutex_lock(&heap->stats_lock);
+	struct PupGCStats *stats = &heap->gc_stats;
+	stats->cycles++;
+	stats->bytes_copied += pup_gc_get_bytes_copied(gc_state);
+	stats->survival_rate = examined ? (double)live / examined : 0;
+	pthread_mutex_unlock(&heap->stats_lock);
+}
+
+static void perform_gc(struct PupHeap *heap)
+{
+	struct PupGCState *gc_state = get_gc_state(heap);
+	pup_gc_period_start(gc_state);
+	// the barrier must be logging before any stack is snapshotted,
+	AO_store(&heap->marking_active, true);
+	PUP_GC_EVENT(1, PUP_GC_EV_ROOTS_START, 0, 0);
+	stop_mutators(heap, GC_PHASE_ROOTS);
+	scan_registered_roots(heap, gc_state);
+	PUP_GC_EVENT(1, PUP_GC_EV_ROOTS_END, 0, 0);
 	// all threads have arrived at a safepoint, scanned their stacks
 	// for 'root' references, and added them to a reference queue, so
 	// now scan the rest of the heap
-	pup_gc_scan_heap(gc_state);
+	if (heap->gc_stop_the_world) {
+		pup_gc_scan_heap(gc_state);
+	} else {
+		// ...while the mutators run, relying on the pre-write barrier
+		// to log any reference they overwrite,
+		release_mutators(heap);
+		pup_gc_scan_heap(gc_state);
+		// then pause again to take the references logged meanwhile,
+		PUP_GC_EVENT(1, PUP_GC_EV_REMARK_START, 0, 0);
+		stop_mutators(heap, GC_PHASE_REMARK);
+		pup_gc_scan_heap(gc_state);
+		PUP_GC_EVENT(1, PUP_GC_EV_REMARK_END, 0, 0);
+	}
+	AO_store(&heap->marking_active, false);
+	release_mutators(heap);
 
+	PUP_GC_EVENT(1, PUP_GC_EV_SWEEP_START, 0, 0);
 	collect_unmarked_objects(heap);
+	PUP_GC_EVENT(1, PUP_GC_EV_SWEEP_END, 0, 0);
 	pup_gc_period_end(gc_state);
+	record_cycle(heap, gc_state);
 }
 
 static void *gc_thread(void *arg)
@@ -374,26 +1298,104 @@ static void *gc_thread(void *arg)
 		int res = nanosleep(&req, NULL);
 		ABORTF_ON(res==EINVAL, "nanosleep() reports invalid timespec");
 		ABORTF_ON(res==EFAULT, "nanosleep() reports EFAULT");
+		// heap_thread_stop() must not cancel us part way through a
+		// collection,
+		int cancel_state;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
 		perform_gc(heap);
+		pthread_setcancelstate(cancel_state, NULL);
 	}
 	return NULL;
 }
 
+static int sweep_thread_count(void)
+{
+	const char *threads = getenv("PUP_GC_THREADS");
+	int count;
+	if (threads) {
+		count = atoi(threads);
+	} else {
+		count = sysconf(_SC_NPROCESSORS_ONLN);
+		if (count > MAX_DEFAULT_SWEEP_THREADS) {
+			count = MAX_DEFAULT_SWEEP_THREADS;
+		}
+	}
+	// the gc thread itself always sweeps too,
+	return count > 1 ? count - 1 : 0;
+}
+
+static void sweep_threads_stop(struct PupHeap *heap)
+{
+	pthread_mutex_lock(&heap->sweep_lock);
+	heap->sweep_shutdown = true;
+	pthread_cond_broadcast(&heap->sweep_start);
+	pthread_mutex_unlock(&heap->sweep_lock);
+	for (int i=0; i<heap->sweep_thread_count; i++) {
+		pthread_join(heap->sweep_threads[i], NULL);
+	}
+	free(heap->sweep_threads);
+	pthread_cond_destroy(&heap->sweep_done);
+	pthread_cond_destroy(&heap->sweep_start);
+	pthread_mutex_destroy(&heap->sweep_lock);
+}
+
+static int sweep_threads_start(struct PupHeap *heap)
+{
+	pthread_mutex_init(&heap->sweep_lock, NULL);
+	pthread_cond_init(&heap->sweep_start, NULL);
+	pthread_cond_init(&heap->sweep_done, NULL);
+	heap->sweep_list = NULL;
+	heap->sweep_generation = 0;
+	heap->sweep_busy = 0;
+	heap->sweep_shutdown = false;
+	int count = sweep_thread_count();
+	heap->sweep_threads = malloc(count * sizeof(pthread_t));
+	heap->sweep_thread_count = 0;
+	if (count && !heap->sweep_threads) {
+		sweep_threads_stop(heap);
+		return 1;
+	}
+	for (int i=0; i<count; i++) {
+		if (pthread_create(&heap->sweep_threads[i], NULL,
+		                   sweep_thread, (void *)heap))
+		{
+			sweep_threads_stop(heap);
+			return 1;
+		}
+		heap->sweep_thread_count++;
+	}
+	return 0;
+}
+
 static int heap_thread_stop(struct PupHeap *heap)
 {
 	int res = pthread_cancel(heap->gc_thread);
 	if (res) {
 		return res;
 	}
-	
-	res = pthread_join(heap->gc_thread, NULL);
+	// the gc thread won't act on the cancellation until it finishes any
+	// collection in progress, which may be waiting on this thread to
+	// reach a safepoint
+	struct timespec poll = {
+		.tv_sec = 0,
+		.tv_nsec = 1000000
+	};
+	while ((res = pthread_tryjoin_np(heap->gc_thread, NULL)) == EBUSY) {
+		pup_heap_safepoint(heap);
+		nanosleep(&poll, NULL);
+	}
+	sweep_threads_stop(heap);
 	return res;
 }
 
 static int heap_thread_start(struct PupHeap *heap)
 {
+	if (sweep_threads_start(heap)) {
+		return 1;
+	}
 	pthread_attr_t attr;
 	if (pthread_attr_init(&attr)) {
+		sweep_threads_stop(heap);
 		return 1;
 	}
 	int res = pthread_create(&heap->gc_thread,
@@ -405,6 +1407,7 @@ static int heap_thread_start(struct PupHeap *heap)
 		return 1;
 	}
 	if (res) {
+		sweep_threads_stop(heap);
 		return 1;
 	}
 	return 0;
@@ -414,7 +1417,7 @@ static void pup_heap_thread_destroy(struct PupHeap *heap)
 {
 	struct PupHeapRegion *local_region = get_thread_info(heap)->local_region;
 	if (local_region) {
-		free_region(local_region);
+		free_region(heap, local_region);
 	}
 }
 
@@ -427,9 +1430,6 @@ static void siguser1_handler(int sig, siginfo_t *si, void *unused)
 	// handler) code in this thread reaches a safepoint, it should notify
 	// the gc thread that this has happened
 	tinfo->gc_waiting = true;
-	// sync the mark value used for thread local allocations with the
-	// current global value
-	tinfo->current_gc_mark = pup_gc_get_current_mark(get_gc_state(heap));
 }
 
 static int setup_signal_handling(struct PupHeap *heap)
@@ -460,22 +1460,60 @@ int pup_heap_init(struct PupHeap *heap)
 
 	heap->region_list = NULL;
 	heap->thread_list = 0;
+	pthread_mutex_init(&heap->threads_lock, NULL);
+	pup_gc_eventlog_init();
+	const char *gc_mode = getenv("PUP_GC_MODE");
+	heap->gc_stop_the_world = gc_mode && !strcmp(gc_mode, "stw");
+	heap->gc_phase = GC_PHASE_ROOTS;
+	heap->marking_active = false;
+	pthread_mutex_init(&heap->hold_lock, NULL);
+	pthread_cond_init(&heap->hold_released, NULL);
+	heap->holding_mutators = false;
+	heap->hold_generation = 0;
+	for (int i=0; i<PUP_GC_PAUSE_BUCKETS; i++) {
+		AO_store(&heap->pause_histogram[i], 0);
+	}
+	AO_store(&heap->bytes_allocated, 0);
+	AO_store(&heap->regions_freed, 0);
+	pthread_mutex_init(&heap->stats_lock, NULL);
+	memset(&heap->gc_stats, 0, sizeof(heap->gc_stats));
+	pthread_mutex_init(&heap->permanent_lock, NULL);
+	heap->permanent_regions = NULL;
+	heap->pause_total_us = 0;
+	heap->time_to_safepoint_total_us = 0;
+	heap->time_to_safepoint_count = 0;
+	pthread_mutex_init(&heap->roots_lock, NULL);
+	heap->roots = NULL;
+	heap->root_count = 0;
+	heap->root_capacity = 0;
+	heap->root_objects = NULL;
+	heap->root_object_count = 0;
+	heap->root_object_capacity = 0;
+	res = regions_init(heap);
+	if (res) {
+		pthread_key_delete(heap->this_thread_info);
+		return res;
+	}
 
 	// initialisation for the main thread,
 	res = pup_heap_thread_init(heap);
 	if (res) {
 		// ignore return value, since we're cleaning up anyway,
+		regions_destroy(heap);
 		pthread_key_delete(heap->this_thread_info);
 		return res;
 	}
 	res = setup_signal_handling(heap);
 	if (res) {
+		pup_heap_thread_destroy(heap);
+		regions_destroy(heap);
 		pthread_key_delete(heap->this_thread_info);
 		return res;
 	}
 	res = heap_thread_start(heap);
 	if (res) {
 		pup_heap_thread_destroy(heap);
+		regions_destroy(heap);
 		pthread_key_delete(heap->this_thread_info);
 		return res;
 	}
@@ -484,28 +1522,65 @@ int pup_heap_init(struct PupHeap *heap)
 	ABORTF_ON(res, "pthread_barrier_init() failed: %s",
 	               strerror(errno));
 	ANNOTATE_BARRIER_INIT(&heap->safepoint_barrier, 2, false);
-	struct PupGCState *gc_state = pup_gc_state_create();
+	struct PupGCState *gc_state = pup_gc_state_create(heap);
 	// FIXME: proper error handling,
 	ABORT_ON(!gc_state, "pup_gc_state_create() failed");
 	set_gc_state(heap, gc_state);
 	return 0;
 }
 
-static void destroy_global_heap(struct PupHeap *heap)
+// the regions themselves go away with the rest of the reservation,
+static void destroy_region_list_objects(struct PupHeapRegion *list)
+{
+	for (struct PupHeapRegion *region = list;
+	     region;
+	     region = (struct PupHeapRegion *)region->next)
+	{
+		destroy_region_objects(region);
+	}
+}
+
+static void release_global_heap(struct PupHeap *heap)
 {
 	struct PupHeapRegion *tail = global_heap_head(heap);
 	while (tail) {
 		struct PupHeapRegion *tmp = tail;
 		tail = region_next(tail);
-		free_region(tmp);
+		region_release(heap, tmp);
 	}
 }
 
 void pup_heap_destroy(struct PupHeap *heap)
 {
 	heap_thread_stop(heap);
-	destroy_global_heap(heap);
-	pup_heap_thread_destroy(heap);
+	if (getenv("PUP_GC_PAUSE_HISTOGRAM")) {
+		print_pause_histogram(heap);
+	}
+	if (pup_gc_eventlog_dump()) {
+		fprintf(stderr, "failed to write the GC event log\n");
+	}
+	pthread_cond_destroy(&heap->hold_released);
+	pthread_mutex_destroy(&heap->hold_lock);
+	pthread_mutex_destroy(&heap->stats_lock);
+	// destroying an object looks at its class, which may live in any
+	// region, so every object goes before any region is released
+	struct PupHeapRegion *local_region = get_thread_info(heap)->local_region;
+	destroy_region_list_objects(global_heap_head(heap));
+	destroy_region_list_objects(heap->large_objects);
+	destroy_region_list_objects(heap->permanent_regions);
+	if (local_region) {
+		destroy_region_objects(local_region);
+	}
+	release_global_heap(heap);
+	if (local_region) {
+		region_release(heap, local_region);
+	}
+	free(heap->roots);
+	free(heap->root_objects);
+	pthread_mutex_destroy(&heap->roots_lock);
+	pthread_mutex_destroy(&heap->permanent_lock);
+	pthread_mutex_destroy(&heap->threads_lock);
+	regions_destroy(heap);
 	if (pthread_key_delete(heap->this_thread_info)) {
 		fprintf(stderr, "heap->this_thread_info was unexpectedly reported to be an invalid key\n");
 	}
@@ -523,18 +1598,15 @@ void *pup_heap_region_make_room_for(struct PupHeapRegion *region,
 	void *tmp = region->allocated;
 	region->allocated += alloc_size_for(size);
 	struct HeapObject *obj = (struct HeapObject *)tmp;
-	obj->object_size = size;
 	obj->kind = kind;
+	obj->forwarded = false;
+	obj->granules = alloc_size_for(size) >> MARK_GRANULE_SHIFT;
+	if (kind == PUP_KIND_OBJ) {
+		region->object_count++;
+	}
 	return obj->data;
 }
 
-static void set_region_next(struct PupHeapRegion *region,
-                            struct PupHeapRegion *next)
-{
-	AO_store(&region->next, (AO_t)next);
-	ANNOTATE_HAPPENS_BEFORE(&region->next);
-}
-
 void pup_heap_add_to_global_heap(struct PupHeap *heap,
                                  struct PupHeapRegion *region)
 {
@@ -550,6 +1622,17 @@ void pup_heap_add_to_global_heap(struct PupHeap *heap,
 }
 
 
+static void account_allocation(struct PupHeap *heap,
+                               struct PupThreadInfo *tinfo,
+                               void *obj,
+                               size_t size)
+{
+	tinfo->bytes_allocated += alloc_size_for(size);
+	// allocations during a collection are treated as live, objects or
+	// not (e.g. an attribute entry, whose owner may already be traced)
+	pup_heap_mark(heap, obj, tinfo->current_gc_mark);
+}
+
 static void *thread_local_alloc(struct PupHeap *heap, size_t size, enum PupHeapKind kind)
 {
 	struct PupThreadInfo *tinfo = get_thread_info(heap);
@@ -559,7 +1642,7 @@ static void *thread_local_alloc(struct PupHeap *heap, size_t size, enum PupHeapK
 		// thread-local region and have the old one added to the global
 		// region list
 		struct PupHeapRegion *old_region = region;
-		region = pup_heap_region_allocate();
+		region = pup_heap_region_allocate(heap);
 		if (!region) {
 			// TODO raise a pup exception or somesuch,
 			ABORTF("pup_heap_region_allocate() failed");
@@ -569,30 +1652,194 @@ static void *thread_local_alloc(struct PupHeap *heap, size_t size, enum PupHeapK
 		pup_heap_add_to_global_heap(heap, old_region);
 	}
 	void *obj = pup_heap_region_make_room_for(region, size, kind);
-	pup_object_gc_mark_unconditionally((struct PupObject *)obj,
-	                                   tinfo->current_gc_mark);
+	account_allocation(heap, tinfo, obj, size);
+	return obj;
+}
+
+/*
+ * Claims a run of 'count' contiguous uncommitted regions of the reserved
+ * range, and makes it accessible.
+ */
+static struct PupHeapRegion *large_region_map(struct PupHeap *heap,
+                                              size_t count)
+{
+	struct PupHeapRegion *region = NULL;
+	size_t first = 0;
+	size_t run = 0;
+	pthread_mutex_lock(&heap->region_pool_lock);
+	for (size_t i=0; i < heap->region_count; i++) {
+		run = heap->region_state[i] == REGION_UNCOMMITTED ? run + 1 : 0;
+		if (run == count) {
+			first = i + 1 - count;
+			heap->region_state[first] = REGION_IN_USE;
+			for (size_t j=first+1; j <= i; j++) {
+				heap->region_state[j] = REGION_LARGE_TAIL;
+			}
+			region = region_at(heap, first);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&heap->region_pool_lock);
+	if (!region) {
+		return NULL;
+	}
+	if (mprotect(region, count << heap->region_shift, PROT_READ|PROT_WRITE)) {
+		pthread_mutex_lock(&heap->region_pool_lock);
+		for (size_t i=first; i < first + count; i++) {
+			heap->region_state[i] = REGION_UNCOMMITTED;
+		}
+		pthread_mutex_unlock(&heap->region_pool_lock);
+		return NULL;
+	}
+	return region;
+}
+
+/*
+ * Objects too big for a normal region get a run of regions to themselves
+ * (the 'large object space').  They are never copied by the collector.
+ */
+static struct PupHeapRegion *large_region_allocate(struct PupHeap *heap,
+                                                   size_t size)
+{
+	size_t span = REGION_HEADER_SIZE + alloc_size_for(size);
+	size_t count = (span + heap->region_size - 1) >> heap->region_shift;
+	struct PupHeapRegion *region = large_region_map(heap, count);
+	if (!region) {
+		return NULL;
+	}
+	region_init(heap, region);
+	region->end = (void *)region + (count << heap->region_shift);
+	return region;
+}
+
+static void *large_object_alloc(struct PupHeap *heap,
+                                size_t size,
+                                enum PupHeapKind kind)
+{
+	struct PupHeapRegion *region = large_region_allocate(heap, size);
+	if (!region) {
+		return NULL;
+	}
+	void *obj = pup_heap_region_make_room_for(region, size, kind);
+	// marked before the sweep can find it on large_objects, or a
+	// collection in progress would free it as unmarked
+	account_allocation(heap, get_thread_info(heap), obj, size);
+	pthread_mutex_lock(&heap->region_pool_lock);
+	region->next = (AO_t)heap->large_objects;
+	heap->large_objects = region;
+	pthread_mutex_unlock(&heap->region_pool_lock);
 	return obj;
 }
 
-static int is_large_object(size_t size)
+static int is_large_object(struct PupHeap *heap, size_t size)
 {
-	return size > MAX_REGION_ALLOCATION;
+	return alloc_size_for(size)
+	       > heap->region_size / LARGE_OBJECT_REGION_FRACTION;
 }
 
 void *pup_heap_alloc(struct PupHeap *heap, size_t size, enum PupHeapKind kind)
 {
-	if (is_large_object(size)) {
-		ABORTF("Large object allocator not implemented yet! (%ld bytes)", size);
+	if (!is_large_object(heap, size)) {
+		return thread_local_alloc(heap, size, kind);
+	}
+	void *obj = large_object_alloc(heap, size, kind);
+	if (!obj) {
+		// TODO raise a pup exception or somesuch,
+		ABORTF("large_object_alloc() failed for %zu bytes", size);
+	}
+	return obj;
+}
+
+void *pup_heap_alloc_permanent(struct PupHeap *heap,
+                               size_t size,
+                               enum PupHeapKind kind)
+{
+	pthread_mutex_lock(&heap->permanent_lock);
+	struct PupHeapRegion *region = heap->permanent_regions;
+	if (!region || !pup_heap_region_have_room_for(region, size)) {
+		region = is_large_object(heap, size)
+		         ? large_region_allocate(heap, size)
+		         : pup_heap_region_allocate(heap);
+		if (!region) {
+			// TODO raise a pup exception or somesuch,
+			ABORTF("failed to allocate a permanent region for %zu bytes", size);
+		}
+		region->next = (AO_t)heap->permanent_regions;
+		heap->permanent_regions = region;
+	}
+	void *obj = pup_heap_region_make_room_for(region, size, kind);
+	pthread_mutex_unlock(&heap->permanent_lock);
+	return obj;
+}
+
+void pup_heap_add_root(struct PupHeap *heap, void **root)
+{
+	pthread_mutex_lock(&heap->roots_lock);
+	if (heap->root_count == heap->root_capacity) {
+		int capacity = heap->root_capacity ? heap->root_capacity * 2 : 64;
+		void ***roots = realloc(heap->roots, capacity * sizeof(void **));
+		ABORT_ON(!roots, "realloc() failed");
+		heap->roots = roots;
+		heap->root_capacity = capacity;
 	}
-	return thread_local_alloc(heap, size, kind);
+	heap->roots[heap->root_count++] = root;
+	pthread_mutex_unlock(&heap->roots_lock);
+}
+
+void pup_heap_add_root_object(struct PupHeap *heap, void *obj)
+{
+	pthread_mutex_lock(&heap->roots_lock);
+	if (heap->root_object_count == heap->root_object_capacity) {
+		int capacity = heap->root_object_capacity
+		             ? heap->root_object_capacity * 2 : 64;
+		void **objs = realloc(heap->root_objects,
+		                      capacity * sizeof(void *));
+		ABORT_ON(!objs, "realloc() failed");
+		heap->root_objects = objs;
+		heap->root_object_capacity = capacity;
+	}
+	heap->root_objects[heap->root_object_count++] = obj;
+	pthread_mutex_unlock(&heap->roots_lock);
+}
+
+void *pup_heap_allocation_containing(struct PupHeap *heap,
+                                     const void *ptr,
+                                     size_t *size)
+{
+	struct PupHeapRegion *region = pup_heap_region_containing(heap, ptr);
+	// (the descriptor of a region not in use may not even be mapped)
+	if (!region
+	    || heap->region_state[pup_heap_region_index(heap, region)]
+	       != REGION_IN_USE
+	    || ptr < region->region
+	    || ptr >= region->allocated)
+	{
+		return NULL;
+	}
+	void *pos = region->region;
+	while (pos < region->allocated) {
+		struct HeapObject *obj = (struct HeapObject *)pos;
+		void *next = pos + heap_object_size(obj);
+		if (ptr < next) {
+			if (ptr < (void *)obj->data) {
+				// the header itself,
+				return NULL;
+			}
+			*size = heap_object_size(obj) - sizeof(struct HeapObject);
+			return obj->data;
+		}
+		pos = next;
+	}
+	return NULL;
 }
 
 void *pup_heap_alloc_for_gc_copy(struct PupHeap *heap,
                                  size_t size,
                                  enum PupHeapKind kind)
 {
-	if (is_large_object(size)) {
-		ABORTF("Large object allocator not implemented yet! (%ld bytes)", size);
+	// large objects are swept in place, so should never reach here,
+	if (is_large_object(heap, size)) {
+		ABORTF("large objects are not copied (%zu bytes)", size);
 	}
 	return pup_gc_alloc_for_copy(get_gc_state(heap), heap, size, kind);
 }
@@ -9,12 +9,56 @@
 struct PupHeapRegion;
 struct PupTheadInfo;
 
+struct PupHeapRegionPoolStats {
+	// region allocations satisfied from the pool of free regions,
+	unsigned long hits;
+	// region allocations that had to map fresh memory,
+	unsigned long misses;
+	// bytes handed back to the OS by munmap() or madvise(MADV_DONTNEED),
+	unsigned long bytes_released;
+};
+
+// collector activity since pup_heap_init(), see pup_heap_get_gc_stats()
+struct PupGCStats {
+	// completed collections,
+	unsigned long cycles;
+	// time mutators spent stopped at gc safepoints, in microseconds; p99
+	// is only as precise as the pause-time histogram buckets
+	unsigned long pause_count;
+	double pause_min_us;
+	double pause_avg_us;
+	double pause_p99_us;
+	double pause_max_us;
+	// allocated by mutators, counted as they reach gc safepoints,
+	unsigned long bytes_allocated;
+	// allocated by the collector for the copies of live objects,
+	unsigned long bytes_copied;
+	// fraction of the objects examined by the last collection that were
+	// still live,
+	double survival_rate;
+	// regions currently holding objects, and regions given up by sweeps,
+	unsigned long regions_in_use;
+	unsigned long regions_freed;
+	// from the collector signalling the mutators until they had all
+	// reached a safepoint, in microseconds
+	double time_to_safepoint_avg_us;
+	double time_to_safepoint_max_us;
+};
+
+// number of buckets in the GC pause-time histogram; bucket i counts pauses
+// of 2^i to 2^(i+1) microseconds
+#define PUP_GC_PAUSE_BUCKETS 24
+
 struct PupHeap {
 	pthread_key_t this_thread_info;
 	struct PupHeapRegion *region_list;
 	pthread_t gc_thread;
 	// actually a 'struct PupThreadInfo *',
 	volatile AO_t thread_list;
+	// held while thread_list is changed, and by the gc thread while it
+	// brings the mutators to a safepoint, so that it never waits for a
+	// thread which has left (see pup_heap_thread_exit())
+	pthread_mutex_t threads_lock;
 	// barrier used for each attempt by the gc thread to coordinate with
 	// a mutator thread at a mutator safepoint,
 	pthread_barrier_t safepoint_barrier;
@@ -22,16 +66,154 @@ struct PupHeap {
 	volatile AO_t gc_state;
 	// actually a 'struct PupVolitileHeapRegion *'
 	volatile AO_t current_global_allocation;
+	// the whole heap lives in this single, region-aligned range of
+	// address space, reserved by pup_heap_init() (PUP_HEAP_MAX_MB),
+	void *reserved_start;
+	size_t reserved_size;
+	// regions are region_size (== 1 << region_shift) bytes, and aligned
+	// to their size (PUP_HEAP_REGION_SHIFT),
+	size_t region_size;
+	int region_shift;
+	// back the heap with transparent huge pages (PUP_HEAP_HUGE_PAGES),
+	bool huge_pages;
+	size_t region_count;
+	// one 'enum RegionState' entry per region of the reserved range,
+	// protected by region_pool_lock
+	unsigned char *region_state;
+	size_t region_search_hint;
+	// a mark bitmap for each of the two alternating mark values, with
+	// one bit per allocation granule of the reserved range,
+	AO_t *mark_bitmaps[2];
+	size_t mark_bitmap_size;
+	// free regions kept for reuse rather than being decommitted; all the
+	// region_pool* fields are protected by region_pool_lock
+	pthread_mutex_t region_pool_lock;
+	struct PupHeapRegion *region_pool;
+	int region_pool_size;
+	// max regions kept in the pool (PUP_HEAP_REGION_POOL),
+	int region_pool_limit;
+	// give pooled regions' pages back to the OS while they are unused
+	// (PUP_HEAP_REGION_POOL_DONTNEED),
+	bool region_pool_dontneed;
+	struct PupHeapRegionPoolStats region_pool_stats;
+	// regions found to hold only garbage by the last sweep, left for
+	// pup_heap_region_allocate() to reuse; protected by region_pool_lock
+	struct PupHeapRegion *reclaim_list;
+	// runs of regions each holding a single large object, which are never
+	// copied; protected by region_pool_lock
+	struct PupHeapRegion *large_objects;
+	// regions of objects that live as long as the heap, and so are never
+	// swept (see pup_heap_alloc_permanent()); the head of the list is the
+	// one allocated from, protected by permanent_lock
+	pthread_mutex_t permanent_lock;
+	struct PupHeapRegion *permanent_regions;
+	// locations outside the heap and the mutators' stacks which hold
+	// references, see pup_heap_add_root(); protected by roots_lock
+	pthread_mutex_t roots_lock;
+	void ***roots;
+	int root_count;
+	int root_capacity;
+	// objects living outside the heap whose references the collector
+	// must follow, see pup_heap_add_root_object(); protected by roots_lock
+	void **root_objects;
+	int root_object_count;
+	int root_object_capacity;
+	// threads which share the sweeping of collected regions with the gc
+	// thread (PUP_GC_THREADS counts the gc thread too),
+	pthread_t *sweep_threads;
+	int sweep_thread_count;
+	// the remaining sweep_* fields are protected by sweep_lock
+	pthread_mutex_t sweep_lock;
+	pthread_cond_t sweep_start;
+	pthread_cond_t sweep_done;
+	// regions still to be swept in the current collection,
+	struct PupHeapRegion *sweep_list;
+	// incremented to start each sweep,
+	unsigned long sweep_generation;
+	// sweeper threads yet to finish the current sweep,
+	int sweep_busy;
+	bool sweep_shutdown;
+	// mark with mutators held at a safepoint throughout, rather than
+	// mostly concurrently (PUP_GC_MODE=stw),
+	bool gc_stop_the_world;
+	// actually an 'enum GCPhase', telling mutators what to do at their
+	// next gc safepoint,
+	volatile AO_t gc_phase;
+	// true while the SATB pre-write barrier needs to log old values,
+	volatile AO_t marking_active;
+	// mutators arriving at a safepoint wait for holding_mutators to be
+	// cleared (or for a later hold_generation), protected by hold_lock
+	pthread_mutex_t hold_lock;
+	pthread_cond_t hold_released;
+	bool holding_mutators;
+	unsigned long hold_generation;
+	// how long mutators spent stopped at gc safepoints, see
+	// PUP_GC_PAUSE_BUCKETS
+	volatile AO_t pause_histogram[PUP_GC_PAUSE_BUCKETS];
+	volatile AO_t bytes_allocated;
+	volatile AO_t regions_freed;
+	// the remaining gc_stats fields, and the totals for the averages,
+	// are protected by stats_lock
+	pthread_mutex_t stats_lock;
+	struct PupGCStats gc_stats;
+	double pause_total_us;
+	double time_to_safepoint_total_us;
+	unsigned long time_to_safepoint_count;
 };
 
 int pup_heap_init(struct PupHeap *heap);
-struct PupHeapRegion *pup_heap_region_allocate();
+struct PupHeapRegion *pup_heap_region_allocate(struct PupHeap *heap);
+
+/**
+ * true if the given address lies within the heap's reserved address range
+ */
+bool pup_heap_contains(struct PupHeap *heap, const void *ptr);
+
+/**
+ * the region which holds the given heap address, or NULL for an address
+ * outside the heap
+ */
+struct PupHeapRegion *pup_heap_region_containing(struct PupHeap *heap,
+                                                 const void *ptr);
+
+/**
+ * the region's position within the heap's reserved range, for indexing
+ * per-region side tables of pup_heap_region_count() entries
+ */
+size_t pup_heap_region_index(struct PupHeap *heap,
+                             struct PupHeapRegion *region);
+size_t pup_heap_region_count(struct PupHeap *heap);
+
+/**
+ * Sets the mark bit of the given heap object in the bitmap for the given
+ * mark value.  Returns true if the bit was newly set, false if the object
+ * was already marked.  Safe to call from several threads at once.
+ */
+bool pup_heap_mark(struct PupHeap *heap, const void *obj, int mark);
+
+/**
+ * Resets the bitmap for the given mark value, ready for a new collection.
+ */
+void pup_heap_clear_marks(struct PupHeap *heap, int mark);
+
+void pup_heap_get_region_pool_stats(struct PupHeap *heap,
+                                    struct PupHeapRegionPoolStats *stats);
 
 enum PupHeapKind {
 	PUP_KIND_OBJ,
 	PUP_KIND_ATTR
 };
 
+// every heap allocation is preceded by a header of this many bytes, which
+// says what kind of allocation it is and how big it is
+#define PUP_HEAP_HEADER_SIZE 8
+
+/**
+ * the kind the given heap allocation was made with; only PUP_KIND_OBJ
+ * allocations hold an object whose references can be traced
+ */
+enum PupHeapKind pup_heap_kind_of(const void *obj);
+
 bool pup_heap_region_have_room_for(struct PupHeapRegion *region, size_t size);
 
 /**
@@ -41,6 +223,37 @@ void pup_heap_destroy(struct PupHeap *heap);
 
 void *pup_heap_alloc(struct PupHeap *heap, size_t size, enum PupHeapKind kind);
 
+/**
+ * Allocates an object which is never swept, for things (like string
+ * literals) that are needed for the lifetime of the heap.
+ */
+void *pup_heap_alloc_permanent(struct PupHeap *heap,
+                               size_t size,
+                               enum PupHeapKind kind);
+
+/**
+ * Registers a location which the collector must treat as a root on every
+ * collection, for as long as the heap exists.
+ */
+void pup_heap_add_root(struct PupHeap *heap, void **root);
+
+/**
+ * Registers an object living outside the heap (e.g. in a runtime image,
+ * see image.h) whose references the collector must follow on every
+ * collection, for as long as the heap exists.
+ */
+void pup_heap_add_root_object(struct PupHeap *heap, void *obj);
+
+/**
+ * The start of the allocation holding the given heap address, setting
+ * '*size' to the allocation's size (not counting its header), or NULL if
+ * the address isn't within any allocation.  Walks the whole region, so is
+ * only for tools like pup_image_write().
+ */
+void *pup_heap_allocation_containing(struct PupHeap *heap,
+                                     const void *ptr,
+                                     size_t *size);
+
 void *pup_heap_alloc_for_gc_copy(struct PupHeap *heap,
                                  size_t size,
                                  enum PupHeapKind kind);
@@ -57,9 +270,41 @@ void *pup_heap_region_make_room_for(struct PupHeapRegion *region,
  */
 int pup_heap_thread_init(struct PupHeap *heap);
 
+/**
+ * Must be called by a thread set up with pup_heap_thread_init() before it
+ * exits, once it holds no more references into the heap.
+ */
+void pup_heap_thread_exit(struct PupHeap *heap);
+
 /**
  * generated code should probably just use pup_safepoint(ENV)
  */
 void pup_heap_safepoint(struct PupHeap *heap);
 
+/**
+ * Must be called with the old value before a reference stored in a heap
+ * object is overwritten, so that concurrent marking still sees everything
+ * that was reachable when it started.
+ */
+void pup_heap_pre_write_barrier(struct PupHeap *heap, void *old_value);
+
+/**
+ * Records the return addresses of the pup frames on the calling thread's
+ * stack (see pup_gc_backtrace()).
+ */
+int pup_heap_backtrace(struct PupHeap *heap, void **addrs, int max);
+
+/**
+ * Copies out the PUP_GC_PAUSE_BUCKETS counts of the pause-time histogram.
+ * Setting PUP_GC_PAUSE_HISTOGRAM prints it when the heap is destroyed.
+ */
+void pup_heap_get_pause_histogram(struct PupHeap *heap,
+                                  unsigned long *buckets);
+
+/**
+ * Fills in 'stats' with a consistent snapshot of the collector's figures.
+ * Safe to call from any thread.
+ */
+void pup_heap_get_gc_stats(struct PupHeap *heap, struct PupGCStats *stats);
+
 #endif  // _HEAP_H
@@ -0,0 +1,357 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+#include "image.h"
+#include "heap.h"
+#include "class.h"
+#include "symtable.h"
+#include "abortf.h"
+
+#define WORD_SIZE sizeof(void *)
+
+// a piece of memory copied into the image,
+struct ImageBlock {
+	const char *addr;
+	size_t size;
+	// offset of the copy of 'addr' within the image,
+	size_t offset;
+	// a heap allocation, preceded in the image by its header,
+	bool heap;
+	bool holds_refs;
+};
+
+// an address range mapped into this process,
+struct MappedRange {
+	uintptr_t start;
+	uintptr_t end;
+};
+
+struct ImageWriter {
+	struct RuntimeEnv *env;
+	struct PupHeap *heap;
+	struct ImageBlock *blocks;
+	int block_count;
+	int block_capacity;
+	size_t size;
+	// everything mapped when writing began, to recognise words pointing
+	// at memory that isn't in the image,
+	struct MappedRange *mappings;
+	int mapping_count;
+};
+
+struct PupObject *pup_image_object(const struct PupImage *image,
+                                   unsigned offset)
+{
+	return (struct PupObject *)((char *)image->data + offset);
+}
+
+static size_t round_to_word(size_t size)
+{
+	return (size + WORD_SIZE - 1) & ~(WORD_SIZE - 1);
+}
+
+// the block holding the given address, if it's to be part of the image,
+static struct ImageBlock *find_block(struct ImageWriter *w, const void *addr)
+{
+	for (int i=0; i<w->block_count; i++) {
+		struct ImageBlock *block = &w->blocks[i];
+		if ((const char *)addr >= block->addr
+		    && (const char *)addr < block->addr + block->size)
+		{
+			return block;
+		}
+	}
+	return NULL;
+}
+
+static void add_block(struct ImageWriter *w, const void *addr, size_t size,
+                      bool heap, bool holds_refs)
+{
+	if (find_block(w, addr)) {
+		return;
+	}
+	if (w->block_count == w->block_capacity) {
+		int capacity = w->block_capacity ? w->block_capacity * 2 : 64;
+		struct ImageBlock *blocks
+			= realloc(w->blocks, capacity * sizeof(struct ImageBlock));
+		ABORT_ON(!blocks, "realloc() failed");
+		w->blocks = blocks;
+		w->block_capacity = capacity;
+	}
+	size_t header = heap ? PUP_HEAP_HEADER_SIZE : 0;
+	struct ImageBlock *block = &w->blocks[w->block_count++];
+	block->addr = addr;
+	block->size = size;
+	block->offset = w->size + header;
+	block->heap = heap;
+	block->holds_refs = holds_refs;
+	w->size += round_to_word(header + size);
+}
+
+static void add_malloced(void *addr, size_t size, bool holds_refs, void *data)
+{
+	add_block((struct ImageWriter *)data, addr, size, false, holds_refs);
+}
+
+static void add_heap_allocation(struct ImageWriter *w, const void *ptr)
+{
+	size_t size;
+	void *alloc = pup_heap_allocation_containing(w->heap, ptr, &size);
+	ABORTF_ON(!alloc, "%p is not within a heap allocation", ptr);
+	add_block(w, alloc, size, true, true);
+}
+
+// adds whatever the given block refers to, so that the image is closed
+static void add_referenced_blocks(struct ImageWriter *w, int index)
+{
+	// (add_block() may move w->blocks)
+	struct ImageBlock block = w->blocks[index];
+	if (block.heap && pup_heap_kind_of(block.addr) == PUP_KIND_OBJ
+	    && pup_is_class_instance(w->env, (struct PupObject *)block.addr))
+	{
+		pup_class_each_malloced((struct PupClass *)block.addr,
+		                        add_malloced, w);
+	}
+	if (!block.holds_refs) {
+		return;
+	}
+	void *const *words = (void *const *)block.addr;
+	for (size_t i=0; i<block.size/WORD_SIZE; i++) {
+		if (pup_heap_contains(w->heap, words[i])) {
+			add_heap_allocation(w, words[i]);
+		}
+	}
+}
+
+static void read_mappings(struct ImageWriter *w)
+{
+	FILE *maps = fopen("/proc/self/maps", "r");
+	ABORT_ON(!maps, "can't open /proc/self/maps");
+	int capacity = 0;
+	unsigned long start, end;
+	char line[512];
+	while (fgets(line, sizeof(line), maps)) {
+		if (sscanf(line, "%lx-%lx", &start, &end) != 2) {
+			continue;
+		}
+		if (w->mapping_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			w->mappings = realloc(w->mappings,
+			                      capacity * sizeof(struct MappedRange));
+			ABORT_ON(!w->mappings, "realloc() failed");
+		}
+		w->mappings[w->mapping_count].start = start;
+		w->mappings[w->mapping_count].end = end;
+		w->mapping_count++;
+	}
+	fclose(maps);
+}
+
+static bool is_mapped(const struct ImageWriter *w, uintptr_t word)
+{
+	for (int i=0; i<w->mapping_count; i++) {
+		if (word >= w->mappings[i].start && word < w->mappings[i].end) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// the image's contents, as words, along with whether each word might need
+// relocating
+static void copy_blocks(struct ImageWriter *w, uintptr_t **words,
+                        bool **relocatable)
+{
+	size_t count = w->size / WORD_SIZE;
+	*words = calloc(count, WORD_SIZE);
+	*relocatable = calloc(count, sizeof(bool));
+	ABORT_ON(!*words || !*relocatable, "calloc() failed");
+	for (int i=0; i<w->block_count; i++) {
+		struct ImageBlock *block = &w->blocks[i];
+		size_t header = block->heap ? PUP_HEAP_HEADER_SIZE : 0;
+		memcpy((char *)*words + block->offset - header,
+		       block->addr - header,
+		       header + block->size);
+		if (block->holds_refs) {
+			memset(*relocatable + block->offset / WORD_SIZE, true,
+			       block->size / WORD_SIZE);
+		}
+	}
+}
+
+// the name of the function or static data (e.g. a method table) at
+// exactly the given address, if any; other addresses within the program
+// or its libraries can't be relocated
+static const char *symbol_name(uintptr_t word, bool *is_function)
+{
+	Dl_info info;
+	const ElfW(Sym) *sym;
+	if (!word || !dladdr1((void *)word, &info, (void **)&sym,
+	                      RTLD_DL_SYMENT))
+	{
+		return NULL;
+	}
+	ABORTF_ON(!info.dli_sname || info.dli_saddr != (void *)word,
+	          "%p (within %s) can't be named in the image; is the "
+	          "symbol static, or the program not linked with -rdynamic?",
+	          (void *)word, info.dli_fname);
+	*is_function = ELF64_ST_TYPE(sym->st_info) == STT_FUNC;
+	return info.dli_sname;
+}
+
+static void write_declarations(FILE *out, const uintptr_t *words,
+                               const bool *relocatable, size_t count)
+{
+	for (size_t i=0; i<count; i++) {
+		if (!relocatable[i]) {
+			continue;
+		}
+		bool is_function;
+		const char *name = symbol_name(words[i], &is_function);
+		if (!name) {
+			continue;
+		}
+		// (each only once,)
+		bool seen = false;
+		for (size_t j=0; j<i && !seen; j++) {
+			seen = relocatable[j] && words[j] == words[i];
+		}
+		if (seen) {
+			continue;
+		}
+		if (is_function) {
+			fprintf(out, "void %s(void);\n", name);
+		} else {
+			fprintf(out, "extern const char %s[];\n", name);
+		}
+	}
+}
+
+static void write_word(struct ImageWriter *w, FILE *out, uintptr_t word,
+                       bool relocatable)
+{
+	struct ImageBlock *block = relocatable ? find_block(w, (void *)word)
+	                                       : NULL;
+	bool is_function;
+	const char *name = relocatable ? symbol_name(word, &is_function) : NULL;
+	if (block) {
+		fprintf(out, "P(0x%zx)",
+		        block->offset + ((const char *)word - block->addr));
+	} else if (name) {
+		fprintf(out, "(void *)%s%s", is_function ? "&" : "", name);
+	} else if (word) {
+		// a pointer to anything else (e.g. malloc()ed memory that
+		// pup_class_each_malloced() didn't report) would dangle
+		ABORTF_ON(relocatable && is_mapped(w, word),
+		          "%p points at memory the image doesn't include",
+		          (void *)word);
+		fprintf(out, "(void *)0x%lxUL", (unsigned long)word);
+	} else {
+		fprintf(out, "0");
+	}
+}
+
+static void write_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') {
+			fprintf(out, "\\%c", *str);
+		} else if (*str < ' ' || *str > '~') {
+			fprintf(out, "\\%03o", (unsigned char)*str);
+		} else {
+			fputc(*str, out);
+		}
+	}
+	fputc('"', out);
+}
+
+void pup_image_write(ENV,
+                     struct PupHeap *heap,
+                     FILE *out,
+                     struct PupObject **roots,
+                     int root_count,
+                     struct SymTable *sym_tab)
+{
+	struct ImageWriter w = {
+		.env = env,
+		.heap = heap,
+		.blocks = NULL,
+		.block_count = 0,
+		.block_capacity = 0,
+		.size = 0,
+		.mappings = NULL,
+		.mapping_count = 0
+	};
+	read_mappings(&w);
+	for (int i=0; i<root_count; i++) {
+		add_heap_allocation(&w, roots[i]);
+	}
+	for (int i=0; i<w.block_count; i++) {
+		add_referenced_blocks(&w, i);
+	}
+	uintptr_t *words;
+	bool *relocatable;
+	copy_blocks(&w, &words, &relocatable);
+	size_t count = w.size / WORD_SIZE;
+
+	fprintf(out, "// generated by pup_image_write(), see image.h\n\n");
+	fprintf(out, "#include \"image.h\"\n\n");
+	write_declarations(out, words, relocatable, count);
+	fprintf(out, "\nstatic void *image_data[%zu];\n\n", count);
+	fprintf(out, "#define P(offset) ((void *)((char *)image_data + (offset)))\n\n");
+	fprintf(out, "static void *image_data[%zu] = {", count);
+	for (size_t i=0; i<count; i++) {
+		fprintf(out, i % 4 ? " " : "\n\t");
+		write_word(&w, out, words[i], relocatable[i]);
+		fprintf(out, ",");
+	}
+	fprintf(out, "\n};\n\n");
+
+	int object_count = 0;
+	fprintf(out, "static const unsigned image_objects[] = {");
+	for (int i=0; i<w.block_count; i++) {
+		struct ImageBlock *block = &w.blocks[i];
+		if (block->heap && pup_heap_kind_of(block->addr) == PUP_KIND_OBJ) {
+			fprintf(out, object_count % 8 ? " " : "\n\t");
+			fprintf(out, "0x%zx,", block->offset);
+			object_count++;
+		}
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const unsigned image_env_roots[] = {");
+	for (int i=0; i<root_count; i++) {
+		fprintf(out, i % 8 ? " " : "\n\t");
+		fprintf(out, "0x%zx,", find_block(&w, roots[i])->offset);
+	}
+	fprintf(out, "\n};\n\n");
+
+	int symbol_count = pup_sym_table_count(sym_tab);
+	fprintf(out, "static const char *const image_symbols[] = {");
+	for (int sym=1; sym<=symbol_count; sym++) {
+		fprintf(out, "\n\t");
+		write_string(out, pup_sym_to_str(sym_tab, sym));
+		fprintf(out, ",");
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "const struct PupImage pup_runtime_image = {\n");
+	fprintf(out, "\t.data = image_data,\n");
+	fprintf(out, "\t.objects = image_objects,\n");
+	fprintf(out, "\t.object_count = %d,\n", object_count);
+	fprintf(out, "\t.env_roots = image_env_roots,\n");
+	fprintf(out, "\t.env_root_count = %d,\n", root_count);
+	fprintf(out, "\t.symbols = image_symbols,\n");
+	fprintf(out, "\t.symbol_count = %d\n", symbol_count);
+	fprintf(out, "};\n");
+
+	free(relocatable);
+	free(words);
+	free(w.blocks);
+	free(w.mappings);
+}
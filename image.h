@@ -0,0 +1,62 @@
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include <stdio.h>
+#include "core_types.h"
+
+struct PupHeap;
+struct SymTable;
+
+/*
+ * A runtime image is the object graph and symbol table built by the
+ * runtime's bootstrap, written out as C source by pup_image_write() (see
+ * tools/mkimage.c) and linked into a program, so that the program can
+ * start without bootstrapping.  References within the image, and to the
+ * runtime's functions, are address constants, so the linker (or dynamic
+ * loader) relocates the image like any other initialised data.
+ *
+ * Image objects live outside the heap, and are never collected; the
+ * collector instead follows their references on every collection (see
+ * pup_heap_add_root_object()).  They may be modified like any other
+ * object (e.g. by defining a method), so an image can back only one
+ * runtime env in a process.
+ */
+
+struct PupImage {
+	// the image's memory; objects are found by their offset into it,
+	void **data;
+	// offsets of the objects (rather than e.g. attribute list entries),
+	const unsigned *objects;
+	int object_count;
+	// offsets of the objects the env refers to, in the order that
+	// pup_image_write() was given them
+	const unsigned *env_roots;
+	int env_root_count;
+	// the strings of symbols 1 to symbol_count,
+	const char *const *symbols;
+	int symbol_count;
+};
+
+/**
+ * The image object at the given offset.
+ */
+struct PupObject *pup_image_object(const struct PupImage *image,
+                                   unsigned offset);
+
+/**
+ * Writes out, as C source defining 'const struct PupImage
+ * pup_runtime_image', every object reachable from the given roots, along
+ * with the given symbol table.  Aborts if the objects refer to memory it
+ * doesn't know how to copy, i.e. if a word of an object holding references
+ * points into memory mapped by the process, but neither into the image nor
+ * at a named function or datum.  The calling program must be linked with
+ * -rdynamic, so that function addresses can be named.
+ */
+void pup_image_write(ENV,
+                     struct PupHeap *heap,
+                     FILE *out,
+                     struct PupObject **roots,
+                     int root_count,
+                     struct SymTable *sym_tab);
+
+#endif  // _IMAGE_H
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include "io.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <atomic_ops.h>
+#include <valgrind/drd.h>
+#include "abortf.h"
+
+#define OUT_BUFFER_SIZE (64 * 1024)
+
+struct OutBuffer {
+	// only the owning thread touches 'used' and 'data', until
+	// pup_io_flush_all()
+	size_t used;
+	// whether a thread owns the buffer; those of exited threads are
+	// handed on to new ones, rather than being taken off buffer_list
+	AO_t owned;
+	// actually a 'struct OutBuffer *',
+	AO_t next;
+	char data[OUT_BUFFER_SIZE];
+};
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+// actually a 'struct OutBuffer *', the list of all threads' buffers,
+static volatile AO_t buffer_list = 0;
+// stdout is a terminal, so write each line as soon as it's complete,
+static bool line_buffered = false;
+
+// Writes the whole of the given iovecs, coping with short writes and with
+// interruption by the collector's signals.  Output that can't be written
+// at all (e.g. because the reader has gone) is dropped.
+static void write_all(struct iovec *iov, int count)
+{
+	while (count > 0) {
+		ssize_t written = writev(STDOUT_FILENO, iov,
+		                         count < IOV_MAX ? count : IOV_MAX);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+static void flush_buffer(struct OutBuffer *buf)
+{
+	if (buf->used) {
+		struct iovec iov = { buf->data, buf->used };
+		write_all(&iov, 1);
+		buf->used = 0;
+	}
+}
+
+// the buffer stays on buffer_list (which is never unlinked from, so that
+// pup_io_flush_all() can walk it without locking) for the next thread to
+// reuse
+static void flush_at_thread_exit(void *data)
+{
+	struct OutBuffer *buf = data;
+	flush_buffer(buf);
+	ANNOTATE_HAPPENS_BEFORE(&buf->owned);
+	AO_store(&buf->owned, false);
+}
+
+static void create_key(void)
+{
+	int res = pthread_key_create(&buffer_key, flush_at_thread_exit);
+	ABORTF_ON(res, "pthread_key_create() failed with %d", res);
+}
+
+void pup_io_init(void)
+{
+	pthread_once(&key_once, create_key);
+	line_buffered = isatty(STDOUT_FILENO);
+}
+
+static void attach_buffer(struct OutBuffer *buf)
+{
+	while (true) {
+		AO_t head = AO_load(&buffer_list);
+		AO_store(&buf->next, head);
+		if (AO_compare_and_swap(&buffer_list, head, (AO_t)buf)) {
+			ANNOTATE_HAPPENS_BEFORE(&buffer_list);
+			return;
+		}
+	}
+}
+
+// a buffer left by an exited thread, if there is one,
+static struct OutBuffer *claim_unowned_buffer(void)
+{
+	for (struct OutBuffer *buf = (struct OutBuffer *)AO_load(&buffer_list);
+	     buf;
+	     buf = (struct OutBuffer *)AO_load(&buf->next))
+	{
+		if (!AO_load(&buf->owned)
+		    && AO_compare_and_swap(&buf->owned, false, true))
+		{
+			ANNOTATE_HAPPENS_AFTER(&buf->owned);
+			return buf;
+		}
+	}
+	return NULL;
+}
+
+static struct OutBuffer *get_buffer(void)
+{
+	struct OutBuffer *buf = pthread_getspecific(buffer_key);
+	if (buf) {
+		return buf;
+	}
+	buf = claim_unowned_buffer();
+	if (!buf) {
+		buf = malloc(sizeof(struct OutBuffer));
+		ABORT_ON(!buf, "malloc() failed");
+		buf->used = 0;
+		AO_store(&buf->owned, true);
+		attach_buffer(buf);
+	}
+	pthread_setspecific(buffer_key, buf);
+	return buf;
+}
+
+void pup_io_write_line(const char *bytes, long length)
+{
+	struct OutBuffer *buf = get_buffer();
+	if (buf->used + length + 1 > OUT_BUFFER_SIZE) {
+		struct iovec iov[3] = {
+			{ buf->data, buf->used },
+			{ (void *)bytes, length },
+			{ "\n", 1 }
+		};
+		if (length + 1 > OUT_BUFFER_SIZE) {
+			// too big to buffer at all, so goes out along with
+			// whatever is buffered, without being copied,
+			write_all(iov, 3);
+			buf->used = 0;
+			return;
+		}
+		write_all(iov, 1);
+		buf->used = 0;
+	}
+	memcpy(buf->data + buf->used, bytes, length);
+	buf->used += length;
+	buf->data[buf->used++] = '\n';
+	if (line_buffered) {
+		flush_buffer(buf);
+	}
+}
+
+void pup_io_flush(void)
+{
+	struct OutBuffer *buf = pthread_getspecific(buffer_key);
+	if (buf) {
+		flush_buffer(buf);
+	}
+}
+
+void pup_io_flush_all(void)
+{
+	ANNOTATE_HAPPENS_AFTER(&buffer_list);
+	int count = 0;
+	for (struct OutBuffer *buf = (struct OutBuffer *)AO_load(&buffer_list);
+	     buf;
+	     buf = (struct OutBuffer *)AO_load(&buf->next))
+	{
+		count++;
+	}
+	if (!count) {
+		return;
+	}
+	struct iovec *iov = malloc(count * sizeof(struct iovec));
+	ABORT_ON(!iov, "malloc() failed");
+	// the list is newest first, so fill from the end to write the
+	// threads' output oldest thread first
+	int i = count;
+	for (struct OutBuffer *buf = (struct OutBuffer *)AO_load(&buffer_list);
+	     buf;
+	     buf = (struct OutBuffer *)AO_load(&buf->next))
+	{
+		i--;
+		iov[i].iov_base = buf->data;
+		iov[i].iov_len = buf->used;
+		buf->used = 0;
+	}
+	write_all(iov, count);
+	free(iov);
+}
@@ -0,0 +1,37 @@
+#ifndef _IO_H
+#define _IO_H
+
+/*
+ * Buffered standard output for puts.  Each thread appends whole lines to a
+ * buffer of its own, so lines from different threads are never torn.  A
+ * thread's buffer is written out when it fills, after every line if
+ * stdout is a terminal, and when the thread exits.  pup_io_flush_all()
+ * writes out every thread's buffer, and must be called before the process
+ * exits (pup_runtime_env_destroy() does this).
+ */
+
+/**
+ * Checks whether stdout is a terminal.  Called once, by the runtime's
+ * initialisation.
+ */
+void pup_io_init(void);
+
+/**
+ * Appends the 'length' bytes at 'bytes', followed by a newline, to the
+ * calling thread's buffer.
+ */
+void pup_io_write_line(const char *bytes, long length);
+
+/**
+ * Writes out the calling thread's buffer.
+ */
+void pup_io_flush(void);
+
+/**
+ * Writes out every thread's buffer, in a single writev() where possible.
+ * No other thread may be writing at the same time (e.g. call this once
+ * they have exited).
+ */
+void pup_io_flush_all(void);
+
+#endif  // _IO_H
@@ -5,11 +5,15 @@
 #include "core_types.h"
 #include "object.h"
 #include "class.h"
+#include "core_syms.h"
 #include "runtime.h"
 #include "exception.h"
+#include "raise.h"
 #include "string.h"
+#include "io.h"
 #include "abortf.h"
 #include "heap.h"
+#include "gc/eventlog.h"
 
 struct PupAttributeListEntry {
 	long name_sym;
@@ -32,8 +36,6 @@ void obj_init(struct PupObject *obj, struct PupClass *type)
 {
 	obj->type = type;
 	obj->attr_list_head = NULL;
-	// would make sense to initialise gc_mark here too, however heap.c
-	// should have already done it
 }
 
 METH_IMPL(pup_object_allocate)
@@ -124,8 +126,19 @@ void pup_object_free(struct PupObject *obj)
  */
 METH_IMPL(pup_object_initialize)
 {
-	// TODO: return nil
-	return NULL;
+	return PUP_NIL;
+}
+
+struct PupClass *pup_object_class(ENV, const struct PupObject *obj)
+{
+	if (!PUP_IS_IMMEDIATE(obj)) {
+		return obj->type;
+	}
+	if (obj == PUP_NIL) {
+		return pup_env_get_classnil(env);
+	}
+	return obj == PUP_TRUE ? pup_env_get_classtrue(env)
+	                       : pup_env_get_classfalse(env);
 }
 
 const char *pup_object_type_name(const struct PupObject *obj)
@@ -133,6 +146,15 @@ const char *pup_object_type_name(const struct PupObject *obj)
 	if (!obj) {
 		return "<NULL Object ref>";
 	}
+	if (obj == PUP_NIL) {
+		return "NilClass";
+	}
+	if (obj == PUP_TRUE) {
+		return "TrueClass";
+	}
+	if (obj == PUP_FALSE) {
+		return "FalseClass";
+	}
 	return pup_type_name(obj->type);
 }
 
@@ -154,7 +176,7 @@ struct PupObject *pup_invoke(ENV, struct PupObject *target, const long name_sym,
                              const long argc, struct PupObject **argv)
 {
 	ABORTF_ON(!target, "NULL target invoking `%s'", pup_env_sym_to_str(env, name_sym));
-	struct PupClass *class = target->type;
+	struct PupClass *class = pup_object_class(env, target);
 	ABORTF_ON(!class, "NULL class invoking `%s' on object %p", pup_env_sym_to_str(env, name_sym), target);
 	PupMethod *method = find_method_in_classes(class, name_sym);
 	if (!method) {
@@ -167,16 +189,18 @@ struct PupObject *pup_invoke(ENV, struct PupObject *target, const long name_sym,
 	return (*method)(env, target, argc, argv);
 }
 
-bool pup_object_instanceof(const struct PupObject *obj,
-                          const struct PupClass *class)
+bool pup_object_instanceof(ENV,
+                           const struct PupObject *obj,
+                           const struct PupClass *class)
 {
-	return obj->type == class;
+	return pup_object_class(env, obj) == class;
 }
 
-bool pup_object_kindof(const struct PupObject *obj,
+bool pup_object_kindof(ENV,
+                       const struct PupObject *obj,
                        const struct PupClass *class)
 {
-	return pup_is_descendant_or_same(class, obj->type);
+	return pup_is_descendant_or_same(class, pup_object_class(env, obj));
 }
 
 
@@ -206,11 +230,19 @@ static struct PupAttributeListEntry *create_attr(ENV, const int sym,
 void pup_iv_set(ENV, struct PupObject *obj,
                 const int sym, struct PupObject *val)
 {
+	if (PUP_IS_IMMEDIATE(obj)) {
+		pup_raise(pup_new_runtimeerrorf(env, "can't modify frozen %s",
+		                                pup_object_type_name(obj)));
+	}
 	struct PupAttributeListEntry *attr = find_attr(obj, sym);
 	// TODO: what to do about these race conditions?
 	if (attr) {
+		pup_env_pre_write_barrier(env, attr->value);
 		attr->value = val;
 	} else {
+		// the list head is a traced reference too
+		pup_env_pre_write_barrier(env,
+			(struct PupObject *)obj->attr_list_head);
 		obj->attr_list_head =
 			create_attr(env, sym, val, obj->attr_list_head);
 	}
@@ -218,39 +250,32 @@ void pup_iv_set(ENV, struct PupObject *obj,
 
 struct PupObject *pup_iv_get(struct PupObject *obj, const int sym)
 {
+	if (PUP_IS_IMMEDIATE(obj)) {
+		return PUP_NIL;
+	}
 	struct PupAttributeListEntry *attr = find_attr(obj, sym);
 	if (attr) {
 		return attr->value;
 	}
-	return NULL;  /* TODO nil */
+	return PUP_NIL;
 }
 
 void pup_object_each_ref(struct PupObject *obj,
                          void (*visitor)(struct PupObject **, void *),
                          void *data)
 {
-	// FIXME: must defer to a per-type function that can e.g. handle
-	// superclass field if obj is a Class etc.
+	// FIXME: Class needs an each_ref too, for e.g. its superclass field
 	visitor((struct PupObject **)&obj->type, data);
+	// the entries themselves are heap allocations too, which are kept
+	// alive by visiting the links to them (like a String's buffer)
+	visitor((struct PupObject **)&obj->attr_list_head, data);
 	struct PupAttributeListEntry *attr = obj->attr_list_head;
 	while (attr) {
 		visitor(&attr->value, data);
+		visitor((struct PupObject **)&attr->next, data);
 		attr = attr->next;
 	}
-}
-
-bool pup_object_gc_mark(struct PupObject *obj, int mark_value)
-{
-	if (obj->gc_mark != mark_value) {
-		obj->gc_mark = mark_value;
-		return true;
-	}
-	return false;
-}
-
-void pup_object_gc_mark_unconditionally(struct PupObject *obj, int mark_value)
-{
-	obj->gc_mark = mark_value;
+	pup_class_each_ref(obj->type, obj, visitor, data);
 }
 
 static void copy_live_object(struct PupObject *obj, struct PupGCState *state)
@@ -260,17 +285,13 @@ static void copy_live_object(struct PupObject *obj, struct PupGCState *state)
 
 void pup_object_gc_collect(struct PupObject *obj, struct PupGCState *state)
 {
-	if (pup_gc_is_live_mark(state, obj->gc_mark)) {
-		pup_gc_inc_live_count(state);
-		copy_live_object(obj, state);
-	} else {
-		pup_gc_inc_garbage_count(state);
-	}
+	pup_gc_inc_live_count(state);
+	copy_live_object(obj, state);
 }
 
 void pup_object_attr_gc_collect(void *attr, struct PupGCState *state)
 {
-	fprintf(stderr, "GC: attr %p\n", attr);
+	PUP_GC_EVENT(3, PUP_GC_EV_ATTR, attr, 0);
 }
 
 /*
@@ -283,7 +304,7 @@ struct PupClass *pup_class_context_from(ENV, struct PupObject *obj)
 	if (pup_is_class_instance(env, obj)) {
 		return (struct PupClass *)obj;
 	}
-	return obj->type;
+	return pup_object_class(env, obj);
 }
 
 static void pup_default_obj_cstr(const struct PupObject *obj,
@@ -294,61 +315,78 @@ static void pup_default_obj_cstr(const struct PupObject *obj,
 	         pup_object_type_name(obj), obj);
 }
 
+// as Ruby prints them,
+static const char *immediate_text(const struct PupObject *obj)
+{
+	return obj == PUP_NIL ? ""
+	     : obj == PUP_TRUE ? "true" : "false";
+}
+
 METH_IMPL(pup_object_to_s)
 {
+	if (PUP_IS_IMMEDIATE(target)) {
+		return pup_string_new_cstr(env, immediate_text(target));
+	}
 	char buf[1024];
 	pup_default_obj_cstr(target, buf, sizeof(buf));
 	return pup_string_new_cstr(env, buf);
 }
 
-char *pup_stringify(ENV, struct PupObject *obj)
+// The text for puts, without copying it out of a String; 'buf' is used
+// for anything else.
+static const char *stringify(ENV,
+                             struct PupObject *obj,
+                             char *buf,
+                             const size_t buf_size,
+                             long *length)
 {
+	if (PUP_IS_IMMEDIATE(obj)) {
+		const char *str = immediate_text(obj);
+		*length = strlen(str);
+		return str;
+	}
 	if (pup_is_string(env, obj)) {
-		return strdup(pup_string_value_unsafe(obj));
+		return pup_string_bytes_unsafe(env, obj, length);
 	}
 	if (pup_instanceof_exception(env, obj)) {
 		const char *msg = exception_text(env, obj);
 		if (msg) {
-			return strdup(msg);
+			*length = strlen(msg);
+			return msg;
 		}
 	}
-	char buf[1024];
-	pup_default_obj_cstr(obj, buf, sizeof(buf));
-	return strdup(buf);
+	pup_default_obj_cstr(obj, buf, buf_size);
+	*length = strlen(buf);
+	return buf;
 }
 
 METH_IMPL(pup_puts)
 {
 	pup_arity_check(env, 1, argc);
 	ABORT_ON(!argv, "puts() argv is NULL!");
-	char *str = pup_stringify(env, argv[0]);
-	puts(str);
-	free(str);
-
-	// TODO return nil
-	return NULL;
+	char buf[1024];
+	long length;
+	const char *str = stringify(env, argv[0], buf, sizeof(buf), &length);
+	pup_io_write_line(str, length);
+	return PUP_NIL;
 }
 
 METH_IMPL(pup_object_op_equals)
 {
 	pup_arity_check(env, 1, argc);
 	struct PupObject *rhs = argv[0];
-	return target == rhs  ? pup_env_get_trueinstance(env)
-	                      : pup_env_get_falseinstance(env);
+	return PUP_BOOL(target == rhs);
 }
 
+const struct PupBuiltinMethod pup_object_methods[] = {
+	{ PUP_SYM_INITIALIZE, pup_object_initialize },
+	{ PUP_SYM_RAISE, pup_object_raise },
+	{ PUP_SYM_PUTS, pup_puts },
+	{ PUP_SYM_OP_EQUALS, pup_object_op_equals }
+};
+
 void pup_object_class_init(ENV, struct PupClass *class_obj)
 {
-	pup_define_method(class_obj,
-	                  pup_env_str_to_sym(env, "initialize"),
-	                  pup_object_initialize);
-	pup_define_method(class_obj,
-	                  pup_env_str_to_sym(env, "raise"),
-	                  pup_object_raise);
-	pup_define_method(class_obj,
-	                  pup_env_str_to_sym(env, "puts"),
-	                  pup_puts);
-	pup_define_method(class_obj,
-	                  pup_env_str_to_sym(env, "=="),
-	                  pup_object_op_equals);
+	pup_class_set_builtin_methods(class_obj, pup_object_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_object_methods));
 }
@@ -11,7 +11,6 @@
 struct PupObject {
 	struct PupClass *type;
 	struct PupAttributeListEntry *attr_list_head;
-	unsigned int gc_mark : 1;
 };
 
 struct PupClass *pup_bootstrap_create_classobject(ENV);
@@ -41,12 +40,20 @@ struct PupObject *pup_create_object(ENV, struct PupClass *type);
 void pup_object_destroy(struct PupObject *obj);
 //void pup_object_free(struct PupObject *obj);
 
+/**
+ * The class of any value, including the immediates (see PUP_NIL), which
+ * have no 'type' field to read.
+ */
+struct PupClass *pup_object_class(ENV, const struct PupObject *obj);
+
 const char *pup_object_type_name(const struct PupObject *obj);
 
-bool pup_object_instanceof(const struct PupObject *obj,
+bool pup_object_instanceof(ENV,
+                           const struct PupObject *obj,
                            const struct PupClass *class);
 
-bool pup_object_kindof(const struct PupObject *obj,
+bool pup_object_kindof(ENV,
+                       const struct PupObject *obj,
                        const struct PupClass *class);
 
 void pup_iv_set(ENV, struct PupObject *obj, const int sym, struct PupObject *val);
@@ -61,13 +68,10 @@ void pup_object_each_ref(struct PupObject *obj,
                          void *data);
 
 /**
- * returns true if the mark was updated, false if the object was already
- * marked.
+ * called for each marked (i.e. live) object in a region being collected
  */
-bool pup_object_gc_mark(struct PupObject *obj, int mark_value);
 void pup_object_gc_collect(struct PupObject *obj, struct PupGCState *state);
 void pup_object_attr_gc_collect(void *attr, struct PupGCState *state);
-void pup_object_gc_mark_unconditionally(struct PupObject *obj, int mark_value);
 
 
 struct PupObject *pup_invoke(ENV, struct PupObject *target, const long name_sym,
@@ -134,6 +134,7 @@ class EqualityExpr < AbstractBinaryExpr; end
 class BitwiseExpr < AbstractBinaryExpr; end
 class AssignExpr < AbstractBinaryExpr; end
 class RelationalExpr < AbstractBinaryExpr; end
+class ShiftExpr < AbstractBinaryExpr; end
 
 class LogicNotExpr < AST
   attr_reader :subexpr
@@ -183,6 +184,9 @@ class BoolLiteral
   end
 end
 
+class NilLiteral
+end
+
 class Block < AST
   attr_accessor :params, :statements
   def initialize(params, statements)
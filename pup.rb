@@ -2,6 +2,15 @@ require 'parser_driver'
 require 'core_types'
 require 'ast_codegen'
 require 'pp'
+require 'optparse'
+
+opt_level = 0
+OptionParser.new do |opts|
+  opts.banner = "usage: pup [-O<level>] <file>.pup"
+  opts.on("-O[LEVEL]", Integer, "optimise the generated code (level 0-3, default 2)") do |level|
+    opt_level = level || 2
+  end
+end.parse!
 
 name = ARGV[0]
 outname = name.sub(/\.pup/, "") + ".bc"
@@ -14,6 +23,8 @@ ast.codegen(ctx)
 
 ctx.build_real_main_fn
 
+ctx.optimise(opt_level)
+
 ctx.module.write_bitcode(outname)
 
 $stderr.puts "wrote #{outname.inspect}"
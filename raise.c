@@ -2,12 +2,18 @@
 #include <string.h>
 #include <unwind.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic_ops.h>
+#include <valgrind/drd.h>
 #include <stdbool.h>
 #include "dwarf.h"
 #include <stdio.h>
 #include "abortf.h"
 #include "core_types.h"
 #include "runtime.h"
+#include "io.h"
+#include "raise.h"
 
 static uint64_t pup_unwindclass
 	= ((uint64_t)'H')<<56
@@ -21,57 +27,100 @@ static uint64_t pup_unwindclass
 
 struct PupUnwindException {
 	struct PupObject *pup_exception;
+	// links the headers on a thread's free list
+	struct PupUnwindException *next_free;
 	struct _Unwind_Exception unwindException;
 };
 
+// Raising is an ordinary way out of e.g. a failed parse, so rather than
+// malloc() a header for every raise, each thread keeps the headers of the
+// exceptions it has caught, for reuse.  An exception is always caught by
+// the thread that raised it, so only that thread touches its free list.
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t free_list_key;
+
+static void free_headers(void *head)
+{
+	struct PupUnwindException *ue = head;
+	while (ue) {
+		struct PupUnwindException *next = ue->next_free;
+		free(ue);
+		ue = next;
+	}
+}
+
+static void create_key(void)
+{
+	int res = pthread_key_create(&free_list_key, free_headers);
+	ABORTF_ON(res, "pthread_key_create() failed with %d", res);
+}
+
+void pup_raise_init(void)
+{
+	pthread_once(&key_once, create_key);
+}
+
+static struct PupUnwindException *pup_unwind_exception(
+	const struct _Unwind_Exception *exceptionObject
+) {
+	return (struct PupUnwindException *)((char *)exceptionObject
+		- offsetof(struct PupUnwindException, unwindException));
+}
+
 static void pup_uwind_exception_cleanup(
 	const _Unwind_Reason_Code reason,
 	struct _Unwind_Exception* cleanup
 ) {
-	// TODO?
-	//fprintf(stderr, "pup_uwind_exception_cleanup(reason:%d, cleanup:%p\n)",
-	//        reason, cleanup);
+	struct PupUnwindException *ue = pup_unwind_exception(cleanup);
+	ue->pup_exception = NULL;
+	ue->next_free = pthread_getspecific(free_list_key);
+	pthread_setspecific(free_list_key, ue);
 }
 
-static struct _Unwind_Exception *create_unwind_exception(
+struct _Unwind_Exception *create_unwind_exception(
 	struct PupObject *pup_exception_obj
 ) {
-	size_t size = sizeof(struct PupUnwindException);
-
-	struct PupUnwindException* ret
-		= (struct PupUnwindException*)memset(malloc(size), 0, size);
-	ret->pup_exception = pup_exception_obj;
-	ret->unwindException.exception_class = pup_unwindclass;
-	ret->unwindException.exception_cleanup = pup_uwind_exception_cleanup;
-	return &(ret->unwindException);
+	struct PupUnwindException *ue = pthread_getspecific(free_list_key);
+	if (ue) {
+		pthread_setspecific(free_list_key, ue->next_free);
+	} else {
+		ue = malloc(sizeof(struct PupUnwindException));
+		ABORT_ON(!ue, "malloc() failed");
+	}
+	memset(&ue->unwindException, 0, sizeof(ue->unwindException));
+	ue->pup_exception = pup_exception_obj;
+	ue->next_free = NULL;
+	ue->unwindException.exception_class = pup_unwindclass;
+	ue->unwindException.exception_cleanup = pup_uwind_exception_cleanup;
+	return &(ue->unwindException);
 }
 
 struct PupObject *extract_exception_obj(
 	const struct _Unwind_Exception *exceptionObject
 ) {
-	// TODO: move somewere sensible?
-	const struct PupUnwindException dummyException;
-	const int64_t baseFromUnwindOffset = ((uintptr_t) &dummyException) - 
-		((uintptr_t) &(dummyException.unwindException));
-	struct PupUnwindException *ue = (struct PupUnwindException *)
-		(((void *) exceptionObject) + baseFromUnwindOffset);
-	return ue->pup_exception;
+	return pup_unwind_exception(exceptionObject)->pup_exception;
+}
+
+struct PupObject *pup_catch_exception(struct _Unwind_Exception *e)
+{
+	struct PupObject *pup_exception = extract_exception_obj(e);
+	// gives the header back to this thread's free list,
+	_Unwind_DeleteException(e);
+	return pup_exception;
 }
 
 void pup_raise(struct PupObject *pup_exception)
 {
 	struct _Unwind_Exception *e = create_unwind_exception(pup_exception);
 	_Unwind_Reason_Code reason = _Unwind_RaiseException(e);
-	ABORT_ON(reason == _URC_END_OF_STACK, "Exception was not caught");
+	if (reason == _URC_END_OF_STACK) {
+		// keep what this thread printed before the exception,
+		pup_io_flush();
+		ABORTF("Exception was not caught");
+	}
 	ABORTF("_Unwind_RaiseException() returned with %d", reason);
 }
 
-void pup_rethrow_uncaught_exception(struct _Unwind_Exception *dw_excep)
-{
-	_Unwind_Reason_Code reason = _Unwind_RaiseException(dw_excep);
-	ABORTF("Unexpectedly failed to rethrow exception; reason code:%d",
-	       reason);
-}
 
 /// read a uleb128 encoded value and advance pointer 
 /// See Variable Length Data in: 
@@ -299,22 +348,42 @@ static void unwind_callsite_read(struct UnwindCallsite *callsite,
 	callsite->action = readULEB128(p);
 }
 
-static bool unwind_callsite_contains(struct UnwindCallsite *callsite,
+static bool unwind_callsite_contains(const struct UnwindCallsite *callsite,
                                      uintptr_t pcOffset)
 {
 	return (callsite->start <= pcOffset)
 	    && (pcOffset < (callsite->start+callsite->length));
 }
 
-static _Unwind_Reason_Code handle_lsda(const uint8_t *lsda,
-                                       const _Unwind_Action actions,
-                                       const uint64_t unwindclass,
-                                       const struct _Unwind_Exception *ue_header,
-                                       struct _Unwind_Context *context)
+// The decoded form of the LSDA of one function: its call-sites which have a
+// landing pad, in order of address (as the LSDA lists them), so that the
+// call-site containing an IP can be found by binary search.  Tables are
+// built the first time an exception passes through the function, and are
+// never freed, as the code they describe is never unloaded.
+struct LsdaTable {
+	const uint8_t *lsda;
+	// actually a 'struct LsdaTable *', the next in the same bucket,
+	AO_t next;
+	struct PupClass **exception_class_table;
+	uintptr_t action_table_start;
+	long count;
+	struct UnwindCallsite callsites[];
+};
+
+#define LSDA_BUCKETS 1024
+
+// actually 'struct LsdaTable *'s; each bucket is a list only ever added to,
+// at its head, so lookups need no lock
+static volatile AO_t lsda_buckets[LSDA_BUCKETS];
+
+static volatile AO_t *lsda_bucket(const uint8_t *lsda)
 {
-	uintptr_t pc = _Unwind_GetIP(context)-1;
-	uintptr_t funcStart = _Unwind_GetRegionStart(context);
-	uintptr_t pcOffset = pc - funcStart;
+	return &lsda_buckets[((uintptr_t)lsda >> 2) % LSDA_BUCKETS];
+}
+
+static struct LsdaTable *decode_lsda(const uint8_t *lsda)
+{
+	const uint8_t *start = lsda;
 	struct PupClass** exception_class_table = NULL;
 
 	uint8_t lpStartEncoding = *lsda++;
@@ -330,67 +399,162 @@ static _Unwind_Reason_Code handle_lsda(const uint8_t *lsda,
 		//        bits of the address; on my 64bit machine?)
 		exception_class_table = (struct PupClass**) (lsda + classInfoOffset);
 	}
-	/* Walk call-site table looking for range that includes current PC. */
 	uint8_t         callSiteEncoding = *lsda++;
 	uint32_t        callSiteTableLength = readULEB128(&lsda);
 	const uint8_t*  callSiteTableStart = lsda;
 	const uint8_t*  callSiteTableEnd = callSiteTableStart + callSiteTableLength;
-	const uintptr_t  action_table_start = (uintptr_t)callSiteTableEnd;
+
+	// one pass to count the entries with landing pads, and another to
+	// keep them
+	long count = 0;
 	const uint8_t* p = callSiteTableStart;
 	while (p < callSiteTableEnd) {
 		struct UnwindCallsite callsite;
 		unwind_callsite_read(&callsite, &p, callSiteEncoding);
+		if (callsite.landingPad) {
+			count++;
+		}
+	}
+	struct LsdaTable *table = malloc(sizeof(struct LsdaTable)
+	                                 + count * sizeof(struct UnwindCallsite));
+	ABORT_ON(!table, "malloc() failed");
+	table->lsda = start;
+	table->exception_class_table = exception_class_table;
+	table->action_table_start = (uintptr_t)callSiteTableEnd;
+	table->count = 0;
+	p = callSiteTableStart;
+	while (p < callSiteTableEnd) {
+		struct UnwindCallsite callsite;
+		unwind_callsite_read(&callsite, &p, callSiteEncoding);
+		if (callsite.landingPad) {
+			table->callsites[table->count++] = callsite;
+		}
+	}
+	return table;
+}
+
+static struct LsdaTable *find_lsda_table(const uint8_t *lsda,
+                                         struct LsdaTable *table)
+{
+	while (table && table->lsda != lsda) {
+		table = (struct LsdaTable *)AO_load(&table->next);
+	}
+	return table;
+}
 
-		if (!callsite.landingPad) {
-			continue; /* no landing pad for this entry */
+static const struct LsdaTable *lsda_table(const uint8_t *lsda)
+{
+	volatile AO_t *bucket = lsda_bucket(lsda);
+	ANNOTATE_HAPPENS_AFTER(bucket);
+	AO_t head = AO_load(bucket);
+	struct LsdaTable *table = find_lsda_table(lsda, (struct LsdaTable *)head);
+	if (table) {
+		return table;
+	}
+	table = decode_lsda(lsda);
+	while (true) {
+		AO_store(&table->next, head);
+		if (AO_compare_and_swap(bucket, head, (AO_t)table)) {
+			ANNOTATE_HAPPENS_BEFORE(bucket);
+			return table;
 		}
-		uintptr_t action_table_entry = 0;
-		// don't consider actions (rescue-blocks) for foreign
-		// exceptions
-		if (!is_foreign_unwindclass(unwindclass) && callsite.action) {
-			action_table_entry = action_table_start + callsite.action - 1;
+		// another thread added to this bucket, maybe this same table,
+		AO_t new_head = AO_load(bucket);
+		struct LsdaTable *other
+			= find_lsda_table(lsda, (struct LsdaTable *)new_head);
+		if (other) {
+			free(table);
+			return other;
 		}
-		if (unwind_callsite_contains(&callsite, pcOffset)) {
-			bool exceptionMatched = false;
-			int64_t actionValue = 0;
-			if (action_table_entry) {
-				exceptionMatched = handle_action_value(
-			    				&actionValue,
-			    				exception_class_table, 
-			    				action_table_entry, 
-			    				unwindclass, 
-			    				ue_header
-				                   );
-			}
-			if (!(actions & _UA_SEARCH_PHASE)) {
-				/* Found landing pad for the PC.
-				 * Set Instruction Pointer to so we re-enter
-				 * function at landing pad. The landing pad is
-				 * created by the compiler to take two
-				 * parameters in registers.
-				 */
-				_Unwind_SetGR(context,
-					      __builtin_eh_return_data_regno(0), 
-					      (uintptr_t)ue_header);
-				if (!action_table_entry || !exceptionMatched) {
-					_Unwind_SetGR(context,
-						      __builtin_eh_return_data_regno(1),
-						      0);
-				} else {
-					_Unwind_SetGR(context,
-					              __builtin_eh_return_data_regno(1),
-						      actionValue);
-				}
-				_Unwind_SetIP(context, funcStart+callsite.landingPad);
-				return _URC_INSTALL_CONTEXT;
-			}
-			if (exceptionMatched) {
-				return _URC_HANDLER_FOUND;
-			}
+		head = new_head;
+	}
+}
+
+// the call-site whose range includes 'pcOffset', if any
+static const struct UnwindCallsite *lsda_table_find(
+	const struct LsdaTable *table,
+	uintptr_t pcOffset
+) {
+	long low = 0;
+	long high = table->count;
+	while (low < high) {
+		long mid = low + (high - low) / 2;
+		if (table->callsites[mid].start <= pcOffset) {
+			low = mid + 1;
+		} else {
+			high = mid;
 		}
 	}
-	
-	/* No landing pad found, continue unwinding. */
+	// low is now the first call-site starting after pcOffset,
+	if (low == 0) {
+		return NULL;
+	}
+	const struct UnwindCallsite *callsite = &table->callsites[low - 1];
+	if (!unwind_callsite_contains(callsite, pcOffset)) {
+		return NULL;
+	}
+	return callsite;
+}
+
+static _Unwind_Reason_Code handle_lsda(const uint8_t *lsda,
+                                       const _Unwind_Action actions,
+                                       const uint64_t unwindclass,
+                                       const struct _Unwind_Exception *ue_header,
+                                       struct _Unwind_Context *context)
+{
+	uintptr_t pc = _Unwind_GetIP(context)-1;
+	uintptr_t funcStart = _Unwind_GetRegionStart(context);
+	uintptr_t pcOffset = pc - funcStart;
+
+	const struct LsdaTable *table = lsda_table(lsda);
+	const struct UnwindCallsite *callsite = lsda_table_find(table, pcOffset);
+	if (!callsite) {
+		/* No landing pad found, continue unwinding. */
+		return _URC_CONTINUE_UNWIND;
+	}
+	uintptr_t action_table_entry = 0;
+	// don't consider actions (rescue-blocks) for foreign
+	// exceptions
+	if (!is_foreign_unwindclass(unwindclass) && callsite->action) {
+		action_table_entry = table->action_table_start
+		                     + callsite->action - 1;
+	}
+	bool exceptionMatched = false;
+	int64_t actionValue = 0;
+	if (action_table_entry) {
+		exceptionMatched = handle_action_value(
+	    				&actionValue,
+	    				table->exception_class_table,
+	    				action_table_entry,
+	    				unwindclass,
+	    				ue_header
+		                   );
+	}
+	if (!(actions & _UA_SEARCH_PHASE)) {
+		/* Found landing pad for the PC.
+		 * Set Instruction Pointer to so we re-enter
+		 * function at landing pad. The landing pad is
+		 * created by the compiler to take two
+		 * parameters in registers.
+		 */
+		_Unwind_SetGR(context,
+			      __builtin_eh_return_data_regno(0),
+			      (uintptr_t)ue_header);
+		if (!action_table_entry || !exceptionMatched) {
+			_Unwind_SetGR(context,
+				      __builtin_eh_return_data_regno(1),
+				      0);
+		} else {
+			_Unwind_SetGR(context,
+			              __builtin_eh_return_data_regno(1),
+				      actionValue);
+		}
+		_Unwind_SetIP(context, funcStart+callsite->landingPad);
+		return _URC_INSTALL_CONTEXT;
+	}
+	if (exceptionMatched) {
+		return _URC_HANDLER_FOUND;
+	}
 	return _URC_CONTINUE_UNWIND;
 }
 
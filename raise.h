@@ -1,3 +1,9 @@
+/**
+ * Sets up the per-thread pools of unwind headers.  Called once, by the
+ * runtime's initialisation.
+ */
+void pup_raise_init(void);
+
 void pup_raise(struct PupObject *pup_exception);
 
 struct _Unwind_Exception *create_unwind_exception(
@@ -7,3 +13,10 @@ struct _Unwind_Exception *create_unwind_exception(
 struct PupObject *extract_exception_obj(
 	const struct _Unwind_Exception *exceptionObject
 );
+
+/**
+ * Called by a landing pad that has caught the given exception; returns the
+ * exception object, and recycles the unwind header.  If no rescue-block
+ * matches, the object must be raised afresh with pup_raise().
+ */
+struct PupObject *pup_catch_exception(struct _Unwind_Exception *e);
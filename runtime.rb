@@ -36,11 +36,14 @@ class RuntimeBuilder
       ["pup_runtime_env_create",
 	[],
 	EnvPtrType],
+      ["pup_runtime_env_destroy",
+	[EnvPtrType],
+	LLVM.Void],
       ["pup_handle_uncaught_exception",
 	[EnvPtrType, LLVM::Int8.type.pointer],
 	ObjectPtrType],
-      ["pup_rethrow_uncaught_exception",
-	[LLVM::Int8.type.pointer],
+      ["pup_raise",
+	[ObjectPtrType],
 	LLVM.Void],
       ["pup_create_class",
 	[EnvPtrType, ClassType.pointer, ClassType.pointer, CStrType],
@@ -54,9 +57,21 @@ class RuntimeBuilder
       ["extract_exception_obj",
 	[LLVM::Int8.type.pointer],
 	ObjectPtrType],
+      ["pup_catch_exception",
+	[LLVM::Int8.type.pointer],
+	ObjectPtrType],
+      ["pup_exception_for_local_raise",
+	[EnvPtrType, ObjectPtrType, ObjectPtrType],
+	ObjectPtrType],
       ["pup_string_new_cstr",
 	[EnvPtrType, CStrType],
 	ObjectPtrType],
+      ["pup_string_new_literal",
+	[EnvPtrType, CStrType],
+	ObjectPtrType],
+      ["pup_env_register_root",
+	[EnvPtrType, ObjectPtrType.pointer],
+	LLVM.Void],
       ["pup_const_get_required",
 	[EnvPtrType, ClassType.pointer, LLVM::Int],
 	ObjectPtrType],
@@ -75,12 +90,6 @@ class RuntimeBuilder
       ["pup_is_descendant_or_same",
 	[ObjectPtrType, ObjectPtrType],
 	LLVM::Int1],
-      ["pup_env_get_trueinstance",
-	[EnvPtrType],
-	ObjectPtrType],
-      ["pup_env_get_falseinstance",
-	[EnvPtrType],
-	ObjectPtrType],
       ["pup_env_get_classobject",
 	[EnvPtrType],
 	ClassType.pointer],
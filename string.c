@@ -8,68 +8,426 @@
 #include "exception.h"
 #include "object.h"
 #include "class.h"
+#include "core_syms.h"
+#include "string.h"
+#include "fixnum.h"
+#include "abortf.h"
 
+enum StringRepr {
+	// characters held inline, in 'value'
+	STRING_FLAT,
+	// characters in a separate heap allocation of 'capacity' bytes, grown
+	// by doubling as the String is appended to
+	STRING_BUFFER,
+	// the concatenation of the frozen Strings 'left' and 'right', copied
+	// into a buffer only when the characters are actually needed
+	STRING_ROPE
+};
+
+// for flat strings, the characters are held inline, after the other fields,
+// in the same heap allocation as the object itself (and NUL terminated, for
+// the benefit of C code); see also StringObjectType in core_types.rb
 struct PupString {
 	struct PupObject obj_header;
-	char *value;
+	long length;
+	// of the characters, or 0 if not yet worked out (see string_hash())
+	unsigned long hash;
+	// literals are shared by every evaluation of the literal expression,
+	// and so must not be modified
+	int frozen;
+	// actually an 'enum StringRepr'
+	int repr;
+	// 'value' or the buffer, or NULL for a rope that's not yet flattened
+	char *bytes;
+	long capacity;
+	struct PupObject *left;
+	struct PupObject *right;
+	char value[];
 };
 
+// concatenations shorter than this are just copied, rather than paying for
+// rope nodes
+#define ROPE_MIN_LENGTH 64
+#define BUFFER_MIN_CAPACITY 16
 
-static struct PupObject *allocate_instance(ENV, struct PupClass *type)
+static void string_init(struct PupString *str,
+                        struct PupClass *type,
+                        long length)
 {
-	struct PupObject *obj =
-		(struct PupObject *)pup_alloc_obj(env, sizeof(struct PupString));
-	obj_init(obj, type);
-	struct PupString *str = (struct PupString *)obj;
-	str->value = NULL;
-	return obj;
+	obj_init(&str->obj_header, type);
+	str->length = length;
+	str->hash = 0;
+	str->frozen = false;
+	str->repr = STRING_FLAT;
+	str->bytes = str->value;
+	str->capacity = 0;
+	str->left = NULL;
+	str->right = NULL;
+	str->value[length] = '\0';
+}
+
+static struct PupString *string_alloc(ENV, struct PupClass *type, long length)
+{
+	struct PupString *str = pup_alloc_obj(env, sizeof(struct PupString)
+	                                           + length + 1);
+	string_init(str, type, length);
+	return str;
+}
+
+struct PupObject *pup_string_allocate_instance(ENV, struct PupClass *type)
+{
+	return (struct PupObject *)string_alloc(env, type, 0);
 }
 
-static void destroy_instance(struct PupObject *obj)
+void pup_string_destroy_instance(struct PupObject *obj)
+{
+	// the characters go along with the object itself, or are in a heap
+	// allocation of their own
+	pup_object_destroy_instance(obj);
+}
+
+struct PupObject *pup_string_gc_copy_instance(ENV, const struct PupObject *obj)
+{
+	const struct PupString *str = (const struct PupString *)obj;
+	long inline_length = str->repr == STRING_FLAT ? str->length : 0;
+	size_t size = sizeof(struct PupString) + inline_length + 1;
+	struct PupString *new_str = pup_env_alloc_obj_for_gc_copy(env, size);
+	memcpy(new_str, obj, size);
+	if (str->repr == STRING_FLAT) {
+		new_str->bytes = new_str->value;
+	}
+	return (struct PupObject *)new_str;
+}
+
+void pup_string_each_ref(struct PupObject *obj,
+                         void (*visitor)(struct PupObject **, void *),
+                         void *data)
 {
 	struct PupString *str = (struct PupString *)obj;
-	if (str->value) {
-		free(str->value);
+	if (str->repr == STRING_BUFFER) {
+		visitor((struct PupObject **)&str->bytes, data);
 	}
-	pup_object_destroy_instance(obj);
+	// NULL unless this is a rope,
+	visitor(&str->left, data);
+	visitor(&str->right, data);
+}
+
+static struct PupString *string_arg(ENV, struct PupObject *obj)
+{
+	if (!pup_is_string(env, obj)) {
+		pup_raise(pup_new_runtimeerrorf(env, "String expected, %s given",
+		                                pup_object_type_name(obj)));
+	}
+	return (struct PupString *)obj;
+}
+
+// Copies the characters of any String to 'dst' (without the NUL).  A String
+// built by repeated concatenation may be a very deep rope, so rather than
+// recursing this fills 'dst' from the end using an explicit stack, which
+// stays small for the left-leaning ropes that 'a = a + b' produces.
+static void copy_chars(char *dst, struct PupString *str)
+{
+	int capacity = 16;
+	int depth = 0;
+	struct PupString **stack = malloc(capacity * sizeof(*stack));
+	ABORT_ON(!stack, "malloc() failed");
+	long end = str->length;
+	stack[depth++] = str;
+	while (depth) {
+		struct PupString *s = stack[--depth];
+		if (s->repr != STRING_ROPE) {
+			end -= s->length;
+			memcpy(dst + end, s->bytes, s->length);
+			continue;
+		}
+		if (depth + 2 > capacity) {
+			capacity *= 2;
+			stack = realloc(stack, capacity * sizeof(*stack));
+			ABORT_ON(!stack, "realloc() failed");
+		}
+		stack[depth++] = (struct PupString *)s->left;
+		stack[depth++] = (struct PupString *)s->right;
+	}
+	free(stack);
 }
 
+// Makes 'buf' (already holding the characters) the string's storage.  The
+// rope children and any old buffer are dropped, so must pass through the
+// write barrier.
+static void set_buffer(ENV, struct PupString *str, char *buf, long capacity)
+{
+	if (str->repr == STRING_BUFFER) {
+		pup_env_pre_write_barrier(env, (struct PupObject *)str->bytes);
+	}
+	pup_env_pre_write_barrier(env, str->left);
+	pup_env_pre_write_barrier(env, str->right);
+	str->bytes = buf;
+	str->capacity = capacity;
+	str->left = NULL;
+	str->right = NULL;
+	str->repr = STRING_BUFFER;
+}
+
+static void flatten(ENV, struct PupString *str)
+{
+	char *buf = pup_alloc_attr(env, str->length + 1);
+	copy_chars(buf, str);
+	buf[str->length] = '\0';
+	set_buffer(env, str, buf, str->length + 1);
+}
+
+static const char *string_chars(ENV, struct PupString *str)
+{
+	if (str->repr == STRING_ROPE) {
+		flatten(env, str);
+	}
+	return str->bytes;
+}
+
+// FNV-1a, remembered until the String is next modified
+static unsigned long string_hash(ENV, struct PupString *str)
+{
+	if (str->hash) {
+		return str->hash;
+	}
+	const unsigned char *p = (const unsigned char *)string_chars(env, str);
+	unsigned long hash = 14695981039346656037UL;
+	for (long i=0; i<str->length; i++) {
+		hash = (hash ^ p[i]) * 1099511628211UL;
+	}
+	// 0 is reserved for 'not yet worked out'
+	str->hash = hash ? hash : 1;
+	return str->hash;
+}
+
+// Gives room for at least 'needed' bytes (including the NUL), doubling the
+// capacity so that a run of appends costs amortised O(1) each.
+static void ensure_capacity(ENV, struct PupString *str, long needed)
+{
+	if (str->repr == STRING_BUFFER && str->capacity >= needed) {
+		return;
+	}
+	long capacity = str->repr == STRING_BUFFER ? str->capacity
+	                                           : BUFFER_MIN_CAPACITY;
+	while (capacity < needed) {
+		capacity *= 2;
+	}
+	char *buf = pup_alloc_attr(env, capacity);
+	copy_chars(buf, str);
+	buf[str->length] = '\0';
+	set_buffer(env, str, buf, capacity);
+}
+
+// A frozen String with the same characters as 'str', for use as one half
+// of a rope; ropes must not see later changes to the Strings they were made
+// from.  A frozen String serves as it is and a rope just needs a new node;
+// only the characters of anything else are copied.
+static struct PupObject *rope_piece(ENV, struct PupString *str)
+{
+	if (str->frozen) {
+		return (struct PupObject *)str;
+	}
+	struct PupString *piece;
+	if (str->repr == STRING_ROPE) {
+		piece = string_alloc(env, pup_env_get_classstring(env), 0);
+		piece->length = str->length;
+		piece->repr = STRING_ROPE;
+		piece->bytes = NULL;
+		piece->left = str->left;
+		piece->right = str->right;
+	} else {
+		piece = string_alloc(env, pup_env_get_classstring(env),
+		                     str->length);
+		memcpy(piece->value, str->bytes, str->length);
+	}
+	piece->frozen = true;
+	return (struct PupObject *)piece;
+}
+
+struct PupObject *pup_string_frozen(ENV, struct PupObject *str)
+{
+	return rope_piece(env, (struct PupString *)str);
+}
+
+static struct PupObject *string_concat(ENV,
+                                       struct PupString *a,
+                                       struct PupString *b)
+{
+	long length = a->length + b->length;
+	struct PupClass *class_string = pup_env_get_classstring(env);
+	if (length < ROPE_MIN_LENGTH) {
+		struct PupString *str = string_alloc(env, class_string, length);
+		copy_chars(str->value, a);
+		copy_chars(str->value + a->length, b);
+		return (struct PupObject *)str;
+	}
+	struct PupObject *left = rope_piece(env, a);
+	struct PupObject *right = rope_piece(env, b);
+	struct PupString *str = string_alloc(env, class_string, 0);
+	str->length = length;
+	str->repr = STRING_ROPE;
+	str->bytes = NULL;
+	str->left = left;
+	str->right = right;
+	return (struct PupObject *)str;
+}
+
+// gives an unfrozen copy, e.g. of a literal that is to be modified
+METH_IMPL(pup_string_dup)
+{
+	pup_arity_check(env, 0, argc);
+	struct PupString *str = (struct PupString *)target;
+	struct PupString *copy = string_alloc(env, target->type, str->length);
+	copy_chars(copy->value, str);
+	return (struct PupObject *)copy;
+}
+
+METH_IMPL(pup_string_plus)
+{
+	pup_arity_check(env, 1, argc);
+	return string_concat(env, (struct PupString *)target,
+	                     string_arg(env, argv[0]));
+}
+
+METH_IMPL(pup_string_append)
+{
+	pup_arity_check(env, 1, argc);
+	pup_string_check_frozen(env, target);
+	struct PupString *str = (struct PupString *)target;
+	struct PupString *other = string_arg(env, argv[0]);
+	// taken first, in case other is str itself
+	long other_length = other->length;
+	ensure_capacity(env, str, str->length + other_length + 1);
+	memcpy(str->bytes + str->length, string_chars(env, other), other_length);
+	str->length += other_length;
+	str->bytes[str->length] = '\0';
+	str->hash = 0;
+	return target;
+}
+
+METH_IMPL(pup_string_length)
+{
+	pup_arity_check(env, 0, argc);
+	return pup_fixnum_create(env, ((struct PupString *)target)->length);
+}
+
+METH_IMPL(pup_string_hash)
+{
+	pup_arity_check(env, 0, argc);
+	return pup_fixnum_create(env, (int)string_hash(env,
+	                                  (struct PupString *)target));
+}
+
+// equal characters, rather than Object#=='s identity
+METH_IMPL(pup_string_op_equals)
+{
+	pup_arity_check(env, 1, argc);
+	struct PupObject *rhs = argv[0];
+	bool equal = target == rhs;
+	if (!equal && pup_is_string(env, rhs)) {
+		struct PupString *a = (struct PupString *)target;
+		struct PupString *b = (struct PupString *)rhs;
+		// hashes are only compared if both are already known,
+		equal = a->length == b->length
+		        && (!a->hash || !b->hash || a->hash == b->hash)
+		        && !memcmp(string_chars(env, a), string_chars(env, b),
+		                   a->length);
+	}
+	return PUP_BOOL(equal);
+}
+
+const struct PupBuiltinMethod pup_string_methods[] = {
+	{ PUP_SYM_DUP, pup_string_dup },
+	{ PUP_SYM_OP_PLUS, pup_string_plus },
+	{ PUP_SYM_OP_APPEND, pup_string_append },
+	{ PUP_SYM_LENGTH, pup_string_length },
+	{ PUP_SYM_HASH, pup_string_hash },
+	{ PUP_SYM_OP_EQUALS, pup_string_op_equals }
+};
+
 struct PupClass *pup_bootstrap_create_classstring(ENV)
 {
-	return pup_internal_create_class(env,
-	                                 pup_env_get_classobject(env),
-	                                 NULL,  // no lexical scope
-	                                 "String",
-	                                 &allocate_instance,
-	                                 &destroy_instance);
+	struct PupClass *class_string =
+		pup_internal_create_class(env,
+		                          pup_env_get_classobject(env),
+		                          NULL,  // no lexical scope
+		                          "String",
+		                          &pup_string_allocate_instance,
+		                          &pup_string_destroy_instance,
+		                          &pup_string_gc_copy_instance);
+	pup_class_set_each_ref(class_string, &pup_string_each_ref);
+	pup_class_set_builtin_methods(class_string, pup_string_methods,
+	                              PUP_BUILTIN_METHOD_COUNT(pup_string_methods));
+	return class_string;
+}
+
+struct PupObject *pup_string_new(ENV, const char *bytes, long length)
+{
+	struct PupString *string =
+		string_alloc(env, pup_env_get_classstring(env), length);
+	memcpy(string->value, bytes, length);
+	return (struct PupObject *)string;
 }
 
 struct PupObject *pup_string_new_cstr(ENV, const char *str)
 {
-	struct PupString *string = malloc(sizeof(struct PupString));
-	if (!string) {
-		return NULL;
-	}
-	obj_init(&(string->obj_header), pup_env_get_classstring(env));
-	string->value = strdup(str);
+	return pup_string_new(env, str, strlen(str));
+}
+
+struct PupObject *pup_string_new_literal(ENV, const char *str)
+{
+	long length = strlen(str);
+	struct PupString *string =
+		pup_alloc_permanent_obj(env, sizeof(struct PupString)
+		                             + length + 1);
+	string_init(string, pup_env_get_classstring(env), length);
+	memcpy(string->value, str, length);
+	string->frozen = true;
+	// worked out up front, as it can't change,
+	string_hash(env, string);
 	return (struct PupObject *)string;
 }
 
-const char *pup_string_value_unsafe(struct PupObject *str)
+void pup_string_check_frozen(ENV, struct PupObject *str)
+{
+	if (((struct PupString *)str)->frozen) {
+		pup_raise(pup_new_runtimeerrorf(env, "can't modify frozen String (use dup)"));
+	}
+}
+
+const char *pup_string_value_unsafe(ENV, struct PupObject *str)
+{
+	return string_chars(env, (struct PupString *)str);
+}
+
+const char *pup_string_bytes_unsafe(ENV, struct PupObject *str, long *length)
 {
-	return ((struct PupString *)str)->value;
+	*length = ((struct PupString *)str)->length;
+	return string_chars(env, (struct PupString *)str);
+}
+
+const char *pup_string_bytes(ENV, struct PupObject *str, long *length)
+{
+	return pup_string_bytes_unsafe(env, (struct PupObject *)string_arg(env, str),
+	                               length);
+}
+
+long pup_string_get_length(ENV, struct PupObject *str)
+{
+	return string_arg(env, str)->length;
+}
+
+unsigned long pup_string_get_hash(ENV, struct PupObject *str)
+{
+	return string_hash(env, string_arg(env, str));
 }
 
 bool pup_is_string(ENV, struct PupObject *obj)
 {
-	return pup_object_instanceof(obj, pup_env_get_classstring(env));
+	return pup_object_instanceof(env, obj, pup_env_get_classstring(env));
 }
 
 const char *pup_string_value(ENV, struct PupObject *str)
 {
-	if (!pup_is_string(env, str)) {
-		pup_raise(pup_new_runtimeerrorf(env, "String expected, %s given",
-		                                pup_object_type_name(str)));
-	}
-	return pup_string_value_unsafe(str);
+	return string_chars(env, string_arg(env, str));
 }
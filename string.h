@@ -3,15 +3,58 @@
 
 struct PupClass *pup_bootstrap_create_classstring(ENV);
 
+/**
+ * Creates a String holding a copy of the 'length' bytes at 'bytes', which
+ * need not be NUL terminated.
+ */
+struct PupObject *pup_string_new(ENV, const char *bytes, long length);
+
 struct PupObject *pup_string_new_cstr(ENV, const char *str);
 
+/**
+ * Creates the single, frozen String object for a string literal.  Generated
+ * code does this once, at startup, for each distinct literal in the
+ * program.
+ */
+struct PupObject *pup_string_new_literal(ENV, const char *str);
+
+/**
+ * Raises an exception if the given String may not be modified; methods
+ * which modify a String must call this first.
+ */
+void pup_string_check_frozen(ENV, struct PupObject *str);
+
+/**
+ * Returns a frozen String with the same characters as 'str'; 'str' itself
+ * if it is already frozen (e.g. a literal), otherwise a copy.
+ */
+struct PupObject *pup_string_frozen(ENV, struct PupObject *str);
+
 /**
  * Returns the C string value from the given object, without a runtime check
  * that the given object is actually a 'struct PupString' (caller must check
- * this).
+ * this).  A String built by concatenation is flattened into a single buffer
+ * the first time its value is needed.
  */
-const char *pup_string_value_unsafe(struct PupObject *str);
+const char *pup_string_value_unsafe(ENV, struct PupObject *str);
 
 const char *pup_string_value(ENV, struct PupObject *str);
 
+/**
+ * Like pup_string_value_unsafe(), but also gives the number of bytes via
+ * 'length', so callers needn't strlen() (the bytes may include NULs).  The
+ * result points into the String itself, and is only valid until the String
+ * is next modified.
+ */
+const char *pup_string_bytes_unsafe(ENV, struct PupObject *str, long *length);
+
+const char *pup_string_bytes(ENV, struct PupObject *str, long *length);
+
+long pup_string_get_length(ENV, struct PupObject *str);
+
+/**
+ * A hash of the String's bytes, cached in the String until it is modified.
+ */
+unsigned long pup_string_get_hash(ENV, struct PupObject *str);
+
 bool pup_is_string(ENV, struct PupObject *obj);
@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include "core_syms.h"
 
 // a *highly* naive symbol table implementation 
 
@@ -13,20 +14,69 @@ struct SymTableEntry {
 
 struct SymTable {
 	int next_sym;
+	// symbols 1 to preloaded_count, in order, from a runtime image,
+	const char *const *preloaded;
+	int preloaded_count;
 	struct SymTableEntry *head;
 };
 
-struct SymTable *pup_sym_table_create()
+struct SymTable *pup_sym_table_create_preloaded(const char *const *strs,
+                                                int count)
 {
 	struct SymTable *st = malloc(sizeof(struct SymTable));
 	if (!st) {
 		return NULL;
 	}
-	st->next_sym = 1;
+	st->next_sym = count + 1;
+	st->preloaded = strs;
+	st->preloaded_count = count;
 	st->head = NULL;
 	return st;
 }
 
+static const char *const core_syms[PUP_CORE_SYM_END] = {
+	[PUP_SYM_NEW] = "new",
+	[PUP_SYM_ALLOCATE] = "allocate",
+	[PUP_SYM_INITIALIZE] = "initialize",
+	[PUP_SYM_TO_S] = "to_s",
+	[PUP_SYM_RAISE] = "raise",
+	[PUP_SYM_PUTS] = "puts",
+	[PUP_SYM_OP_EQUALS] = "==",
+	[PUP_SYM_OP_PLUS] = "+",
+	[PUP_SYM_OP_LESSTHAN] = "<",
+	[PUP_SYM_OP_APPEND] = "<<",
+	[PUP_SYM_DUP] = "dup",
+	[PUP_SYM_LENGTH] = "length",
+	[PUP_SYM_HASH] = "hash",
+	[PUP_SYM_MESSAGE] = "message",
+	[PUP_SYM_BACKTRACE] = "backtrace",
+	[PUP_SYM_STAT] = "stat",
+	[PUP_SYM_IV_MESSAGE] = "@message",
+	[PUP_SYM_OBJECT] = "Object",
+	[PUP_SYM_CLASS] = "Class",
+	[PUP_SYM_STRING] = "String",
+	[PUP_SYM_EXCEPTION] = "Exception",
+	[PUP_SYM_STANDARDERROR] = "StandardError",
+	[PUP_SYM_RUNTIMEERROR] = "RuntimeError",
+	[PUP_SYM_NILCLASS] = "NilClass",
+	[PUP_SYM_TRUECLASS] = "TrueClass",
+	[PUP_SYM_FALSECLASS] = "FalseClass",
+	[PUP_SYM_FIXNUM] = "Fixnum",
+	[PUP_SYM_GC] = "GC"
+};
+
+struct SymTable *pup_sym_table_create()
+{
+	// (symbol 0 isn't used,)
+	return pup_sym_table_create_preloaded(core_syms + 1,
+	                                      PUP_CORE_SYM_END - 1);
+}
+
+int pup_sym_table_count(struct SymTable *st)
+{
+	return st->next_sym - 1;
+}
+
 void pup_sym_table_destroy(struct SymTable *st)
 {
 	struct SymTableEntry *entry = st->head;
@@ -61,8 +111,22 @@ static void find_entry(char *str, struct SymTableEntry ***entryp)
 	}
 }
 
+static int find_preloaded(struct SymTable *st, const char *str)
+{
+	for (int i=0; i<st->preloaded_count; i++) {
+		if (!strcmp(str, st->preloaded[i])) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
 int pup_str_to_sym(struct SymTable *st, char *str)
 {
+	int sym = find_preloaded(st, str);
+	if (sym) {
+		return sym;
+	}
 	struct SymTableEntry **entryp = &st->head;
 	find_entry(str, &entryp);
 	if (*entryp) {
@@ -74,6 +138,11 @@ int pup_str_to_sym(struct SymTable *st, char *str)
 
 bool pup_get_sym(struct SymTable *st, char *str, int *result_sym)
 {
+	int sym = find_preloaded(st, str);
+	if (sym) {
+		*result_sym = sym;
+		return true;
+	}
 	struct SymTableEntry **entryp = &st->head;
 	find_entry(str, &entryp);
 	if (*entryp) {
@@ -85,6 +154,9 @@ bool pup_get_sym(struct SymTable *st, char *str, int *result_sym)
 
 const char *pup_sym_to_str(struct SymTable *st, int sym)
 {
+	if (sym >= 1 && sym <= st->preloaded_count) {
+		return st->preloaded[sym - 1];
+	}
 	struct SymTableEntry *entry = st->head;
 	while (entry) {
 		if (entry->sym == sym) {
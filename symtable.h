@@ -3,8 +3,24 @@
 
 struct SymTable;
 
+/*
+ * A table already holding the runtime's own symbols (see core_syms.h).
+ */
 struct SymTable *pup_sym_table_create();
 
+/*
+ * A table already holding the given strings, as symbols 1 to 'count' (as
+ * recorded in a runtime image, see image.h, which begins with the symbols
+ * of core_syms.h).  Neither the array nor the strings are copied.
+ */
+struct SymTable *pup_sym_table_create_preloaded(const char *const *strs,
+                                                int count);
+
+/*
+ * The number of symbols in the table, which are numbered from 1.
+ */
+int pup_sym_table_count(struct SymTable *st);
+
 void pup_sym_table_destroy(struct SymTable *st);
 
 /*
@@ -11,14 +11,18 @@ class Result
 end
 
 class Tester
+  # PUP_OPT=<level> to run the tests optimised by both pup and llc
+  OPT = ENV["PUP_OPT"] ? "-O#{ENV["PUP_OPT"]}" : ""
+
   def method_missing(name, *args, &block)
     Dir.chdir("tests") do
-      raise "pup failed" unless system("../pup #{name}.pup")
-      raise "llc failed" unless system("/home/dave/opt/llvm-3.0/bin/llc -load ../gclib/Release+Asserts/lib/pupgcplugin.so #{name}.bc -o #{name}.S")
+      raise "pup failed" unless system("../pup #{OPT} #{name}.pup")
+      # frame pointers are required by the GC's stack walker
+      raise "llc failed" unless system("/home/dave/opt/llvm-3.0/bin/llc #{OPT} -load ../gclib/Release+Asserts/lib/pupgcplugin.so -disable-fp-elim #{name}.bc -o #{name}.S")
       raise "as failed" unless system("as #{name}.S -o #{name}.o")
       # -rdynamic is required for the dlopen hackery used to find stack gc
       # root maps
-      cmd = "gcc -rdynamic -pthread #{name}.o ../runtime.o ../exception.o ../raise.o ../string.o ../class.o ../object.o ../symtable.o ../env.o ../heap.o ../fixnum.o ../gc.o ../gc/refqueue.o -lrt -lunwind -lunwind-x86_64 -ldl"
+      cmd = "gcc -rdynamic -pthread #{name}.o ../runtime.o ../exception.o ../raise.o ../string.o ../class.o ../object.o ../symtable.o ../image.o ../env.o ../heap.o ../fixnum.o ../gcstat.o ../io.o ../gc.o ../gc/refqueue.o ../gc/eventlog.o ../runtime_image.o -lrt -lunwind -lunwind-x86_64 -ldl"
       raise "#{cmd.inspect} failed" unless system(cmd)
       res = Result.new
       opts = args[0]
@@ -14,6 +14,12 @@ end
 test.gc(:vmlimit=>256) do
   stdout.should match /success/
 end
+test.gc_ivars(:vmlimit=>256) do
+  stdout.should match /success/
+end
+test.gc_stat do
+  stdout.should match /^\s*success\s+success\s*$/
+end
 test.while do
   stdout.should match /^\s*success\s+success\s+success\s*$/
 end
@@ -35,9 +41,27 @@ end
 test.raise_string do
   stdout.should match /success/
 end
+test.string_literal do
+  stdout.should match /^\s*success\s+success\s+success\s*$/
+end
+test.string_concat do
+  stdout.split(/\s/).should == %w{concat concatenation con success success}
+end
+test.string_equality do
+  stdout.split(/\s/).should == %w{success success success success}
+end
 test.globals do
   stdout.split(/\s/).should == %w{Object Class String TrueClass FalseClass Exception}
 end
+test.nil do
+  stdout.split(/\s/).should == %w{success success true success}
+end
 test.rescue_types do
   stdout.should match /success/
 end
+test.local_raise do
+  stdout.split(/\s/).should == %w{success success success success}
+end
+test.exception_backtrace do
+  stdout.should match /fail_here/
+end
@@ -0,0 +1,58 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../gc/eventlog.h"
+
+// Prints the events of a GC event log (see gc/eventlog.h), in time order,
+// with times relative to the first event.
+//
+//   tools/gclog_dump [pup-gc.log]
+
+static int compare_events(const void *a, const void *b)
+{
+	const struct PupGCEvent *ea = a;
+	const struct PupGCEvent *eb = b;
+	if (ea->time_ns != eb->time_ns) {
+		return ea->time_ns < eb->time_ns ? -1 : 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = argc > 1 ? argv[1] : "pup-gc.log";
+	FILE *in = fopen(filename, "rb");
+	if (!in) {
+		perror(filename);
+		return 1;
+	}
+	struct PupGCLogHeader header;
+	if (fread(&header, sizeof(header), 1, in) != 1
+	    || memcmp(header.magic, PUP_GC_LOG_MAGIC, sizeof(header.magic))
+	    || header.event_size != sizeof(struct PupGCEvent))
+	{
+		fprintf(stderr, "%s: not a GC event log\n", filename);
+		return 1;
+	}
+	struct PupGCEvent *events = malloc(header.event_count
+	                                   * sizeof(struct PupGCEvent));
+	if (header.event_count && !events) {
+		fprintf(stderr, "malloc() failed\n");
+		return 1;
+	}
+	size_t count = fread(events, sizeof(struct PupGCEvent),
+	                     header.event_count, in);
+	fclose(in);
+	qsort(events, count, sizeof(struct PupGCEvent), compare_events);
+	for (size_t i=0; i<count; i++) {
+		struct PupGCEvent *ev = &events[i];
+		printf("%12.3f us  thread %-3u %-18s %#llx %#llx\n",
+		       (ev->time_ns - events[0].time_ns) / 1e3,
+		       ev->thread,
+		       pup_gc_event_name(ev->type),
+		       (unsigned long long)ev->a,
+		       (unsigned long long)ev->b);
+	}
+	free(events);
+	return 0;
+}
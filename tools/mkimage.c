@@ -0,0 +1,35 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "../env.h"
+
+// Bootstraps a runtime env and writes it out as a runtime image (see
+// image.h), for linking into pup programs as runtime_image.o.
+//
+//   tools/mkimage runtime_image.c
+//
+// Must be linked with -rdynamic, and without a runtime image of its own.
+
+int main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s output.c\n", argv[0]);
+		return 1;
+	}
+	struct RuntimeEnv *env = pup_runtime_env_create();
+	if (!env) {
+		fprintf(stderr, "pup_runtime_env_create() failed\n");
+		return 1;
+	}
+	FILE *out = fopen(argv[1], "w");
+	if (!out) {
+		perror(argv[1]);
+		return 1;
+	}
+	pup_env_write_image(env, out);
+	if (fclose(out)) {
+		perror(argv[1]);
+		return 1;
+	}
+	pup_runtime_env_destroy(env);
+	return 0;
+}